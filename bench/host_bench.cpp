@@ -0,0 +1,45 @@
+// host benchmark: the DS_MQTT_BENCH cases on linux/, see bench/README.txt
+#define DS_MQTT_BENCH 1
+#ifndef DS_MQTT_BENCH_ITERATIONS
+#define DS_MQTT_BENCH_ITERATIONS 50000U
+#endif
+#include <ds_mqtt_manager.h>
+#include <stdio.h>
+
+#ifndef BENCH_PROPS
+#define BENCH_PROPS 8
+#endif
+
+constexpr size_t PROPS_NUM = BENCH_PROPS;
+constexpr char strID[] = "host_bench";
+char names[PROPS_NUM][12];
+const char *propsNames[PROPS_NUM];
+int numbers[PROPS_NUM];
+
+void onSrt() {}
+void onRst() {}
+void on_cmd() {}
+prop_CBs_t prop_cbs = {on_cmd, on_cmd, on_cmd};
+props_CBs_t props_cbs[PROPS_NUM];
+
+typedef MQTT_manager<PROPS_NUM, strID, propsNames, numbers, onSrt, onRst, props_cbs> manager_t;
+
+struct ds_mqtt_host {
+  static void bench(manager_t *manager)
+  {
+    manager->_bench();
+  }
+};
+
+int main()
+{
+  for (size_t i = 0; i < PROPS_NUM; ++i) {
+    snprintf(names[i], sizeof(names[i]), "prop_%u", static_cast<unsigned>(i));
+    propsNames[i] = names[i];
+    numbers[i] = i + 1;
+    props_cbs[i] = &prop_cbs;
+  }
+  /// not connected: the cases' msgs only reach the console
+  ds_mqtt_host::bench(new manager_t(new Console(), 10));
+  return 0;
+}
@@ -1,172 +1,2407 @@
 #ifndef DS_MQTT_MANAGER
 #define DS_MQTT_MANAGER
 
+/*!
+* @brief 1 includes the Ethernet library for ds_MQTT::w5500, the default
+*        transport
+* @detail on ESP32/ESP8266 it is 1 only if the library is installed, so
+*         WiFi-only boards build with ds_MQTT::wifi<SSID, PASSWORD> as
+*         the transport without it
+*/
+#ifndef DS_MQTT_ETHERNET
+#if !defined(ESP32) && !defined(ESP8266)
+#define DS_MQTT_ETHERNET 1
+#elif defined(__has_include)
+#if __has_include(<Ethernet.h>)
+#define DS_MQTT_ETHERNET 1
+#else
+#define DS_MQTT_ETHERNET 0
+#endif
+#else
+#define DS_MQTT_ETHERNET 0
+#endif
+#endif
+
 #include <ds_console.h>
+#if DS_MQTT_ETHERNET
 #include <Ethernet.h>
+#endif
 #include <PubSubClient.h>
 #include <Arduino.h>
+#if defined(ESP32)
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#endif
+#ifdef __AVR__
 #include <avr/wdt.h>
+#endif
+
+/*!
+* @file contains class MQTT_manager, types and values
+*       to operate props using MQTT protocol
+*/
+
+/*!
+* @brief period of the controller health publish (ms), 0 turns it off
+* @detail define it before including the header to override
+*/
+#ifndef DS_MQTT_HEALTH_PERIOD
+#define DS_MQTT_HEALTH_PERIOD 30000UL
+#endif
+
+/*!
+* @brief console verbosity, the calls (and their strings) of the levels
+*        above it are not compiled at all
+* @detail DS_MQTT_LOG_NONE, DS_MQTT_LOG_ERROR (missing hardware, failed
+*         connects) or DS_MQTT_LOG_INFO (progress and the diagnostics'
+*         dumps too); errors are counted at any level, see "err" in
+*         the health msg
+*/
+#define DS_MQTT_LOG_NONE  0
+#define DS_MQTT_LOG_ERROR 1
+#define DS_MQTT_LOG_INFO  2
+#ifndef DS_MQTT_LOG_LEVEL
+#define DS_MQTT_LOG_LEVEL DS_MQTT_LOG_INFO
+#endif
+
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_ERROR
+#define DS_MQTT_LOG_E(...) __VA_ARGS__
+#else
+#define DS_MQTT_LOG_E(...)
+#endif
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_INFO
+#define DS_MQTT_LOG_I(...) __VA_ARGS__
+#else
+#define DS_MQTT_LOG_I(...)
+#endif
+
+/*!
+* @brief 1 paints the free SRAM at startup to measure the stack high-water mark
+* @detail see ds_MQTT::stack_unused and ds_MQTT::stack_max
+*/
+#ifndef DS_MQTT_STACK_PAINT
+#define DS_MQTT_STACK_PAINT 0
+#endif
+
+/*!
+* @brief 1 accumulates time spent in each section of routine()
+* @detail "profile" to /er/diag publishes it to /er/diag/info,
+*         "profile_reset" drops it; see DS_MQTT_CYCLES for cycle counts
+*/
+#ifndef DS_MQTT_PROFILE
+#define DS_MQTT_PROFILE 0
+#endif
+
+/*!
+* @brief 1 makes the profiler and the benchmarks count CPU cycles
+* @detail Timer1 runs at clk/1 and its overflows extend it to 32 bits
+*         (wraps after 268 s at 16 MHz, enough for a single section);
+*         the numbers are the target's real ones, under simavr as well
+* @warning takes Timer1 (Servo uses it too) and defines its overflow ISR,
+*          so include the header with it on in a single translation unit
+*/
+#ifndef DS_MQTT_CYCLES
+#define DS_MQTT_CYCLES 0
+#endif
+
+/*!
+* @brief 1 samples the interrupted program counter on Timer2 compare
+* @detail the samples are a histogram over the flash window
+*         [DS_MQTT_SAMPLER_LO, DS_MQTT_SAMPLER_HI) of
+*         DS_MQTT_SAMPLER_BUCKETS buckets; "samples" to /er/diag dumps it
+*         to /er/diag/info and the console, "samples_reset" drops it;
+*         tools/ds_mqtt_symbolize.py maps the buckets to the ELF symbols
+* @warning takes Timer2 (tone() uses it too) and defines its ISR,
+*          so include the header with it on in a single translation unit
+*/
+#ifndef DS_MQTT_SAMPLER
+#define DS_MQTT_SAMPLER 0
+#endif
+#ifndef DS_MQTT_SAMPLER_BUCKETS
+#define DS_MQTT_SAMPLER_BUCKETS 64
+#endif
+#ifndef DS_MQTT_SAMPLER_LO
+#define DS_MQTT_SAMPLER_LO 0UL
+#endif
+#ifndef DS_MQTT_SAMPLER_HI
+#define DS_MQTT_SAMPLER_HI (FLASHEND + 1UL)
+#endif
+#ifndef DS_MQTT_SAMPLER_OCR
+#define DS_MQTT_SAMPLER_OCR 77 // 16 MHz / 1024 / 78 ~ 200 Hz
+#endif
+
+/*!
+* @brief 1 enables micro-benchmarks of the hot paths
+* @detail "bench" to /er/diag runs them and publishes a msg per case
+*         to /er/diag/info (and the console); routine() is blocked
+*         for DS_MQTT_BENCH_ITERATIONS runs of every case
+*/
+#ifndef DS_MQTT_BENCH
+#define DS_MQTT_BENCH 0
+#endif
+#ifndef DS_MQTT_BENCH_ITERATIONS
+#define DS_MQTT_BENCH_ITERATIONS 100U
+#endif
+
+/*!
+* @brief 1 runs the prop callbacks on a thread of their own (hosts, see linux/)
+* @detail the network thread calls routine() which queues the commands,
+*         the prop logic thread runs their callbacks with dispatch() and
+*         reports the states with setState(); both queues are lock-free
+*         single producer single consumer rings of DS_MQTT_QUEUE_SIZE
+*/
+#ifndef DS_MQTT_THREADED
+#define DS_MQTT_THREADED 0
+#endif
+#ifndef DS_MQTT_QUEUE_SIZE
+#define DS_MQTT_QUEUE_SIZE 16U
+#endif
+
+#if !defined(__AVR__) && (DS_MQTT_STACK_PAINT || DS_MQTT_SAMPLER || DS_MQTT_CYCLES)
+#error "DS_MQTT_STACK_PAINT, DS_MQTT_SAMPLER and DS_MQTT_CYCLES are AVR only"
+#endif
+/*!
+* @brief period of the props' info msgs (ms), the ERP's heartbeat
+*/
+#ifndef DS_MQTT_INFO_REFRESH
+#define DS_MQTT_INFO_REFRESH 1000UL
+#endif
+
+/*!
+* @brief 1 adapts the info period to the broker and the link
+* @detail a period whose publishes failed or took over DS_MQTT_INFO_LAG
+*         ms (with DS_MQTT_QOS1 also the PUBACKs' average round trip)
+*         doubles the period up to DS_MQTT_INFO_MAX, a good one halves
+*         its distance to DS_MQTT_INFO_REFRESH; a command, a state change
+*         or a reconnect shortens it to DS_MQTT_INFO_FAST for
+*         DS_MQTT_INFO_BOOST ms, unless backed off, so a loaded broker
+*         is not flooded by a fleet's reconnects
+*/
+#ifndef DS_MQTT_INFO_ADAPTIVE
+#define DS_MQTT_INFO_ADAPTIVE 0
+#endif
+#ifndef DS_MQTT_INFO_MAX
+#define DS_MQTT_INFO_MAX 16000UL
+#endif
+#ifndef DS_MQTT_INFO_FAST
+#define DS_MQTT_INFO_FAST 250UL
+#endif
+#ifndef DS_MQTT_INFO_BOOST
+#define DS_MQTT_INFO_BOOST 2000UL
+#endif
+#ifndef DS_MQTT_INFO_LAG
+#define DS_MQTT_INFO_LAG 100UL
+#endif
+
+/*!
+* @brief 1 keeps the props' states in the manager and publishes the changed
+*        ones only: setState() marks them in a bitmap, routine() renders the
+*        marked ones, finding them a word at a time
+* @detail a change goes out on the next routine(), at most
+*         DS_MQTT_INFO_BURST msgs per call; every DS_MQTT_INFO_REFRESH ms
+*         (see DS_MQTT_INFO_ADAPTIVE) all the props are marked again,
+*         the ERP takes them as a heartbeat
+*/
+#ifndef DS_MQTT_DIRTY
+#define DS_MQTT_DIRTY 0
+#endif
+#ifndef DS_MQTT_INFO_BURST
+#define DS_MQTT_INFO_BURST 16U
+#endif
+
+/*!
+* @brief 1 keeps the session on the broker (clean session off) and
+*        subscribes to the command topics at QoS 1
+* @detail the broker queues the commands sent while the controller is
+*         away and delivers them on reconnect, PubSubClient acknowledges
+*         them; a reconnect finding the session present (the CONNACK
+*         flag, see ds_MQTT::session_client) skips the subscribing, the
+*         first connect after boot always subscribes in case the topics
+*         changed; turns DS_MQTT_DEDUP on by default since QoS 1 may
+*         deliver a command twice, the ERP's "#<seq>" makes it exact
+*/
+#ifndef DS_MQTT_PERSISTENT
+#define DS_MQTT_PERSISTENT 0
+#endif
+
+/*!
+* @brief 1 adds publish_qos1(): QoS 1 publishes tracked in a window of
+*        DS_MQTT_QOS1_WINDOW packets, resent with DUP every
+*        DS_MQTT_QOS1_TIMEOUT ms until their PUBACK
+* @detail PubSubClient publishes at QoS 0 only, so the packets are built
+*         in the window's slots (DS_MQTT_QOS1_PACKET bytes each) and
+*         written to the client directly, the PUBACKs are picked from
+*         the incoming bytes by ds_MQTT::session_client; with
+*         DS_MQTT_DIRTY the states' changes go at QoS 1, the refreshes
+*         (the heartbeat) stay at QoS 0
+*/
+#ifndef DS_MQTT_QOS1
+#define DS_MQTT_QOS1 0
+#endif
+#ifndef DS_MQTT_QOS1_WINDOW
+#define DS_MQTT_QOS1_WINDOW 2U
+#endif
+#ifndef DS_MQTT_QOS1_TIMEOUT
+#define DS_MQTT_QOS1_TIMEOUT 2000UL
+#endif
+#ifndef DS_MQTT_QOS1_PACKET
+#define DS_MQTT_QOS1_PACKET 200U
+#endif
+
+/*!
+* @brief 1 runs a command once though it arrives several times, e.g. via
+*        overlapping subscriptions or the broadcast and a group topic
+* @detail a command to /er/cmd or a prop's /er/<id>/cmd may end with
+*         "#<seq>" ("start#1234"), the sequence number given by the ERP;
+*         the numbers are global across the topics, the last
+*         DS_MQTT_DEDUP_SIZE ones are remembered and a repeated one is
+*         dropped whatever its topic is if it came within
+*         DS_MQTT_DEDUP_SEQ_WINDOW ms, so an ERP restarting its numbering
+*         is not ignored for longer than that; the suffix is cut off before
+*         the callbacks; any other msg (without it, to special_CB's or
+*         extra topics, left as it is) is dropped if the same topic and
+*         payload came within DS_MQTT_DEDUP_WINDOW ms; /er/diag is not
+*         filtered
+*/
+#ifndef DS_MQTT_DEDUP
+#define DS_MQTT_DEDUP DS_MQTT_PERSISTENT
+#endif
+#ifndef DS_MQTT_DEDUP_SIZE
+#define DS_MQTT_DEDUP_SIZE 8U
+#endif
+#ifndef DS_MQTT_DEDUP_WINDOW
+#define DS_MQTT_DEDUP_WINDOW 100UL
+#endif
+#ifndef DS_MQTT_DEDUP_SEQ_WINDOW
+#define DS_MQTT_DEDUP_SEQ_WINDOW 10000UL
+#endif
+
+/*!
+* @brief 1 keeps the last DS_MQTT_RECORDER_SIZE events (boot, connects,
+*        outages, commands, state changes, slow loops) in RAM that is not
+*        cleared on reset and publishes them on every connect
+* @detail one {"id":"<CLIENT_NAME>","rec":"<event>","seq":<n>,"ms":<millis()>,
+*         "v":<value>} per event to /er/diag/info, the ones published
+*         before are skipped until the next boot; a slow loop is a
+*         routine() period above DS_MQTT_RECORDER_SLOW ms while connected;
+*         the ring lives in DS_MQTT_NOINIT: .noinit on AVR (survives the
+*         watchdog and the reset button, not power loss) and ESP32, in
+*         ordinary RAM elsewhere
+*/
+#ifndef DS_MQTT_RECORDER
+#define DS_MQTT_RECORDER 0
+#endif
+#ifndef DS_MQTT_RECORDER_SIZE
+#define DS_MQTT_RECORDER_SIZE 16U
+#endif
+#ifndef DS_MQTT_RECORDER_SLOW
+#define DS_MQTT_RECORDER_SLOW 250UL
+#endif
+/*!
+* @brief 1 traces the last DS_MQTT_TRACE_SIZE msgs in and out
+* @detail "trace" to /er/diag dumps them oldest first to /er/diag/info
+*         and the console, one {"id":"<CLIENT_NAME>","trace":"in"|"out",
+*         "ms":<millis()>,"topic":"<FNV-1a hash, hex>","prop":<index or -1>,
+*         "verb":"<verb>","len":<payload B>,"us":<msg handler's time>}
+*         per msg, with "dup":true appended for a duplicate DS_MQTT_DEDUP
+*         dropped; the verb is the one without the "#<seq>" suffix;
+*         traced in the network thread (routine(), publish())
+*/
+#ifndef DS_MQTT_TRACE
+#define DS_MQTT_TRACE 0
+#endif
+#ifndef DS_MQTT_TRACE_SIZE
+#define DS_MQTT_TRACE_SIZE 16U
+#endif
+
+#ifndef DS_MQTT_NOINIT
+#if defined(__AVR__)
+#define DS_MQTT_NOINIT __attribute__((section(".noinit")))
+#elif defined(ESP32)
+#define DS_MQTT_NOINIT __NOINIT_ATTR
+#else
+#define DS_MQTT_NOINIT
+#endif
+#endif
+
+/// the transport's client is wrapped by ds_MQTT::session_client
+#define DS_MQTT_SNOOP (DS_MQTT_PERSISTENT || DS_MQTT_QOS1)
+
+/// the states are set with setState() and routine() takes no arguments
+#define DS_MQTT_OWN_STATES (DS_MQTT_THREADED || DS_MQTT_DIRTY)
+
+#if defined(__AVR__) && DS_MQTT_THREADED
+#error "DS_MQTT_THREADED needs a host with threads"
+#endif
+
+#if DS_MQTT_THREADED
+#include <atomic>
+#endif
+
+/// subscribe to /er/diag if any diagnostics is on
+#define DS_MQTT_DIAG (DS_MQTT_PROFILE || DS_MQTT_SAMPLER || DS_MQTT_BENCH || DS_MQTT_TRACE)
+
+constexpr char MQTT_STRSTATUS_READY[]    = "Not activated"; // "Ready"?
+constexpr char MQTT_STRSTATUS_ENABLED[]  = "Activated";
+constexpr char MQTT_STRSTATUS_FINISHED[] = "Finished";
+
+constexpr size_t PROP_STATUS_MAX_SIZE       = 16U;
+constexpr size_t PROP_CB_TYPES_NUM          = 3U; // onActivate, onFinish, onReset
+
+enum prop_cb_types { MQTT_CB_ACTIVATE, MQTT_CB_FINISH, MQTT_CB_RESET };
+typedef void(*prop_CBs_t[PROP_CB_TYPES_NUM])(void);
+typedef prop_CBs_t* props_CBs_t;
+typedef char prop_state_t[PROP_STATUS_MAX_SIZE];
+typedef char *const props_states_t;
+
+#ifdef __AVR__
+/*!
+* @brief MCUSR saved before the sketch starts
+* @detail lives in .noinit since .bss is cleared after .init3;
+*         MCUSR has to be cleared that early, otherwise the watchdog
+*         stays on after ds_MQTT::reset and the board resets in a loop;
+*         optiboot clears MCUSR itself and passes its value in r2
+*/
+static uint8_t ds_mqtt_reset_flags __attribute__((section(".noinit")));
+
+static void ds_mqtt_save_reset_flags() __attribute__((naked, used, section(".init3")));
+static void ds_mqtt_save_reset_flags()
+{
+  uint8_t flags = MCUSR;
+  if (flags == 0)
+    asm volatile("mov %0, r2" : "=r"(flags));
+  ds_mqtt_reset_flags = flags;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+extern char __heap_start;
+extern char *__brkval;
+#endif
+
+#if DS_MQTT_RECORDER
+/*!
+* @brief a flight recorder's event, check covers the other fields
+*/
+struct ds_mqtt_record_t {
+  uint32_t ms;
+  uint16_t seq;
+  uint16_t value;
+  uint8_t  type;
+  uint8_t  check;
+};
+
+/*!
+* @brief the flight recorder's ring, records[seq % size] is the next one
+* @detail left as it is by the reset, magic tells a ring from the
+*         power-on garbage and the records' checks a complete record
+*         from one torn by the reset
+*/
+struct ds_mqtt_recorder_t {
+  uint16_t         magic;
+  uint16_t         seq;
+  ds_mqtt_record_t records[DS_MQTT_RECORDER_SIZE];
+};
+
+static ds_mqtt_recorder_t ds_mqtt_recorder DS_MQTT_NOINIT;
+#endif
+
+#if DS_MQTT_STACK_PAINT
+constexpr uint8_t DS_MQTT_STACK_CANARY = 0xC5;
+
+/*!
+* @brief fills everything between the heap start and the stack with the canary
+* @detail runs in .init3: r1 is cleared and SP is set, nothing is on the stack yet
+*/
+static void ds_mqtt_paint_stack() __attribute__((naked, used, section(".init3")));
+static void ds_mqtt_paint_stack()
+{
+  uint8_t *p = reinterpret_cast<uint8_t*>(&__heap_start);
+  while (p < reinterpret_cast<uint8_t*>(SP))
+    *p++ = DS_MQTT_STACK_CANARY;
+}
+#endif
+
+#if DS_MQTT_SAMPLER
+/// smallest shift making the window fit into the buckets
+constexpr uint8_t ds_mqtt_sampler_shift(uint8_t shift = 0)
+{
+  return ((DS_MQTT_SAMPLER_HI - DS_MQTT_SAMPLER_LO - 1) >> shift) < DS_MQTT_SAMPLER_BUCKETS ?
+         shift : ds_mqtt_sampler_shift(shift + 1);
+}
+
+constexpr uint8_t DS_MQTT_SAMPLER_SHIFT = ds_mqtt_sampler_shift();
+
+/*!
+* @brief the samples' histogram
+* @detail buckets[i] counts byte addresses
+*         [LO + (i << SHIFT), LO + ((i + 1) << SHIFT)),
+*         outside counts the ones beyond the window;
+*         all the counters are halved when one is about to overflow
+*/
+struct ds_mqtt_samples_t {
+  uint16_t buckets[DS_MQTT_SAMPLER_BUCKETS];
+  uint16_t outside;
+};
+static volatile ds_mqtt_samples_t ds_mqtt_samples;
+
+/*!
+* @brief accounts a sample, called from the Timer2 ISR
+* @param [in] pc the interrupted program counter (word address)
+*/
+static void ds_mqtt_sample(uint32_t pc) __attribute__((used));
+static void ds_mqtt_sample(uint32_t pc)
+{
+  uint32_t offset = (pc << 1) - DS_MQTT_SAMPLER_LO;
+  volatile uint16_t *counter = &ds_mqtt_samples.outside;
+  if (offset < DS_MQTT_SAMPLER_HI - DS_MQTT_SAMPLER_LO) // wraps below LO
+    counter = &ds_mqtt_samples.buckets[offset >> DS_MQTT_SAMPLER_SHIFT];
+
+  if (*counter == 0xFFFF) {
+    for (uint8_t i = 0; i < DS_MQTT_SAMPLER_BUCKETS; ++i)
+      ds_mqtt_samples.buckets[i] >>= 1;
+    ds_mqtt_samples.outside >>= 1;
+  }
+  ++*counter;
+}
+
+/*!
+* @brief fetches the return address pushed by the interrupt
+* @detail naked to know the exact stack layout: 15 bytes are pushed
+*         here, the PC is right above them (high byte first, three
+*         bytes on the devices over 128 KB), passed in r22..r25
+*/
+ISR(TIMER2_COMPA_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r0              \n\t"
+    "in   r0, __SREG__    \n\t"
+    "push r0              \n\t"
+    "push r1              \n\t"
+    "clr  r1              \n\t"
+    "push r18             \n\t"
+    "push r19             \n\t"
+    "push r20             \n\t"
+    "push r21             \n\t"
+    "push r22             \n\t"
+    "push r23             \n\t"
+    "push r24             \n\t"
+    "push r25             \n\t"
+    "push r26             \n\t"
+    "push r27             \n\t"
+    "push r30             \n\t"
+    "push r31             \n\t"
+    "in   r30, __SP_L__   \n\t"
+    "in   r31, __SP_H__   \n\t"
+#ifdef __AVR_3_BYTE_PC__
+    "ldd  r24, Z+16       \n\t"
+    "ldd  r23, Z+17       \n\t"
+    "ldd  r22, Z+18       \n\t"
+#else
+    "clr  r24             \n\t"
+    "ldd  r23, Z+16       \n\t"
+    "ldd  r22, Z+17       \n\t"
+#endif
+    "clr  r25             \n\t"
+    "call %x0             \n\t"
+    "pop  r31             \n\t"
+    "pop  r30             \n\t"
+    "pop  r27             \n\t"
+    "pop  r26             \n\t"
+    "pop  r25             \n\t"
+    "pop  r24             \n\t"
+    "pop  r23             \n\t"
+    "pop  r22             \n\t"
+    "pop  r21             \n\t"
+    "pop  r20             \n\t"
+    "pop  r19             \n\t"
+    "pop  r18             \n\t"
+    "pop  r1              \n\t"
+    "pop  r0              \n\t"
+    "out  __SREG__, r0    \n\t"
+    "pop  r0              \n\t"
+    "reti                 \n\t"
+    :: "i" (ds_mqtt_sample)
+  );
+}
+#endif
+
+#if DS_MQTT_CYCLES
+static volatile uint16_t ds_mqtt_cycles_hi;
+
+ISR(TIMER1_OVF_vect)
+{
+  ++ds_mqtt_cycles_hi;
+}
+#endif
+
+struct ds_MQTT {
+/*!
+* @brief restarts the controller
+* @detail on hosts (see linux/) the process exits and is to be
+*         restarted by its supervisor, e.g. systemd's Restart=
+*/
+  static void reset()
+  {
+#ifdef __AVR__
+    wdt_enable(WDTO_60MS);
+    delay(1000);
+#elif defined(ESP32) || defined(ESP8266)
+    ESP.restart();
+#else
+    exit(EXIT_FAILURE);
+#endif
+  }
+
+/*!
+* @brief bounded strcat
+* @param [in,out] dst zero terminated string
+* @param [in] size dst's capacity including the terminator
+* @param [in] src string to append
+* @return false if src had to be truncated
+*/
+  static bool append(char *dst, size_t size, const char *src)
+  {
+    size_t len = strlen(dst);
+    while (*src && len + 1 < size)
+      dst[len++] = *src++;
+    dst[len] = 0;
+    return *src == 0;
+  }
+
+/*!
+* @brief checks whether a string goes into a JSON string as it is
+* @return false if it has '"', '\\' or control characters
+*/
+  static bool json_safe(const char *src)
+  {
+    for (; *src; ++src) {
+      if (*src == '"' || *src == '\\' || static_cast<uint8_t>(*src) < 0x20)
+        return false;
+    }
+    return true;
+  }
+
+/*!
+* @brief append() escaping src for a JSON string
+* @detail truncation never cuts an escape sequence
+*/
+  static bool append_json(char *dst, size_t size, const char *src)
+  {
+    static const char hex[] = "0123456789abcdef";
+    size_t len = strlen(dst);
+    for (; *src; ++src) {
+      uint8_t c = *src;
+      char esc[6] = {'\\', static_cast<char>(c)};
+      size_t n = 2;
+      if (c < 0x20) {
+        esc[1] = 'u';
+        esc[2] = '0';
+        esc[3] = '0';
+        esc[4] = hex[c >> 4];
+        esc[5] = hex[c & 0xF];
+        n = 6;
+      } else if (c != '"' && c != '\\') {
+        esc[0] = c;
+        n = 1;
+      }
+      if (len + n >= size)
+        break;
+      memcpy(dst + len, esc, n);
+      len += n;
+    }
+    dst[len] = 0;
+    return *src == 0;
+  }
+
+/*!
+* @brief compares a not terminated payload with a word
+* @param [in] payload received msg payload
+* @param [in] length payload's length
+* @param [in] word zero terminated string
+*/
+  static bool payload_is(const uint8_t *payload, unsigned int length, const char *word)
+  {
+    return strlen(word) == length && memcmp(payload, word, length) == 0;
+  }
+
+/*!
+* @brief FNV-1a hash of the bytes
+* @param [in] seed a previous hash to chain the bytes to
+*/
+  static uint32_t hash(const uint8_t *data, size_t length, uint32_t seed = 2166136261UL)
+  {
+    for (size_t k = 0; k < length; ++k)
+      seed = (seed ^ data[k]) * 16777619UL;
+    return seed;
+  }
+
+/*!
+* @brief the heap's current end
+*/
+  static const char* heap_top()
+  {
+#ifdef __AVR__
+    return __brkval ? __brkval : &__heap_start;
+#else
+    return static_cast<const char*>(sbrk(0));
+#endif
+  }
+
+/*!
+* @brief gap between the heap top and the stack pointer
+* @return free SRAM in bytes, 0 off AVR where it is not tracked
+*/
+  static int free_ram()
+  {
+#ifdef __AVR__
+    char top;
+    return &top - heap_top();
+#else
+    return 0;
+#endif
+  }
+
+#if DS_MQTT_STACK_PAINT
+/*!
+* @brief bytes between the heap top and the deepest stack frame ever seen
+* @return untouched canary bytes, i.e. the lowest free SRAM since boot
+* @warning scans up to the whole free SRAM, do not call it every loop
+*/
+  static int stack_unused()
+  {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(heap_top());
+    const uint8_t *start = p;
+    while (p <= reinterpret_cast<const uint8_t*>(RAMEND) && *p == DS_MQTT_STACK_CANARY)
+      ++p;
+    return p - start;
+  }
+
+/*!
+* @brief stack high-water mark
+* @return the deepest stack usage since boot in bytes
+*/
+  static int stack_max()
+  {
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(heap_top());
+    return RAMEND - reinterpret_cast<uintptr_t>(p) - stack_unused();
+  }
+#endif
+
+#if DS_MQTT_CYCLES
+  static constexpr unsigned long TICKS_PER_MS = F_CPU / 1000UL;
+
+/*!
+* @brief starts Timer1 as the free running cycle counter
+*/
+  static void cycles_start()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TCNT1  = 0;
+    TIMSK1 = _BV(TOIE1);
+    SREG = sreg;
+  }
+
+/*!
+* @brief CPU cycles since cycles_start()
+* @detail an overflow pending while reading is accounted here
+*/
+  static unsigned long ticks()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t lo = TCNT1;
+    uint16_t hi = ds_mqtt_cycles_hi;
+    if ((TIFR1 & _BV(TOV1)) && lo < 0x8000)
+      ++hi;
+    SREG = sreg;
+    return static_cast<unsigned long>(hi) << 16 | lo;
+  }
+#else
+  static constexpr unsigned long TICKS_PER_MS = 1000UL;
+
+  static unsigned long ticks()
+  {
+    return micros();
+  }
+#endif
+
+#if DS_MQTT_SAMPLER
+/*!
+* @brief starts sampling: Timer2 in CTC mode, clk/1024, compare A interrupt
+*/
+  static void sampler_start()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    TCCR2A = _BV(WGM21);
+    TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+    OCR2A  = DS_MQTT_SAMPLER_OCR;
+    TCNT2  = 0;
+    TIMSK2 |= _BV(OCIE2A);
+    SREG = sreg;
+  }
+
+/*!
+* @brief pauses sampling, sampler_start() resumes it
+*/
+  static void sampler_stop()
+  {
+    TIMSK2 &= ~_BV(OCIE2A);
+  }
+
+  static void sampler_reset()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    memset(const_cast<ds_mqtt_samples_t*>(&ds_mqtt_samples), 0, sizeof(ds_mqtt_samples));
+    SREG = sreg;
+  }
+
+/*!
+* @brief reads a counter consistently with the ISR
+* @param [in] i bucket index, DS_MQTT_SAMPLER_BUCKETS for the outside one
+*/
+  static uint16_t sampler_count(uint8_t i)
+  {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = i < DS_MQTT_SAMPLER_BUCKETS ?
+                     ds_mqtt_samples.buckets[i] : ds_mqtt_samples.outside;
+    SREG = sreg;
+    return count;
+  }
+#endif
+
+/*!
+* @brief human readable cause of the last reset
+* @return "wdt", "bor", "ext", "por" or "?" if unknown
+*/
+  static const char* reset_cause()
+  {
+#ifndef __AVR__
+    return "?";
+#else
+    if (ds_mqtt_reset_flags & _BV(WDRF))
+      return "wdt";
+    if (ds_mqtt_reset_flags & _BV(BORF))
+      return "bor";
+    if (ds_mqtt_reset_flags & _BV(EXTRF))
+      return "ext";
+    if (ds_mqtt_reset_flags & _BV(PORF))
+      return "por";
+    return "?";
+#endif
+  }
+#if DS_MQTT_RECORDER
+  static_assert((DS_MQTT_RECORDER_SIZE & (DS_MQTT_RECORDER_SIZE - 1)) == 0,
+                "DS_MQTT_RECORDER_SIZE must be a power of 2");
+  static constexpr uint16_t RECORDER_MAGIC = 0xD5EC;
+  static constexpr uint16_t RECORD_NO_PROP = 0xFFFF;
+
+  enum record_types {
+    REC_BOOT,         /// < v: reset flags (MCUSR) on AVR
+    REC_CONNECT,
+    REC_CONNECT_FAIL, /// < v: PubSubClient's state()
+    REC_DISCONNECT,
+    REC_NO_HARDWARE,
+    REC_NO_LINK,
+    REC_ACTIVATE,     /// < the commands, v: prop index or -1 for /er/cmd
+    REC_FINISH,
+    REC_RESET,
+    REC_START,
+    REC_COMMAND,      /// < any other payload
+    REC_STATE,        /// < v: prop index
+    REC_SLOW,         /// < v: routine() period, ms
+    REC_TYPES
+  };
+
+  static const char* record_name(uint8_t type)
+  {
+    static const char *const names[REC_TYPES] = {
+      "boot", "connect", "connectFail", "disconnect", "noHardware", "noLink",
+      "activate", "finish", "reset", "start", "cmd", "state", "slow"
+    };
+    return type < REC_TYPES ? names[type] : "?";
+  }
+
+  static uint8_t record_check(const ds_mqtt_record_t &r)
+  {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&r);
+    uint8_t check = 0x5A;
+    for (size_t k = 0; k < offsetof(ds_mqtt_record_t, check); ++k)
+      check = (check << 1 | check >> 7) ^ bytes[k];
+    return check;
+  }
+
+/*!
+* @brief keeps the ring left by the previous run unless it is garbage
+*/
+  static void recorder_start()
+  {
+    if (ds_mqtt_recorder.magic == RECORDER_MAGIC)
+      return;
+    memset(&ds_mqtt_recorder, 0, sizeof(ds_mqtt_recorder));
+    ds_mqtt_recorder.magic = RECORDER_MAGIC;
+  }
+
+/*!
+* @brief adds an event, overwriting the oldest one
+* @detail the record is complete before seq moves past it
+*/
+  static void record(uint8_t type, uint16_t value = 0)
+  {
+    ds_mqtt_record_t &r = ds_mqtt_recorder.records[ds_mqtt_recorder.seq % DS_MQTT_RECORDER_SIZE];
+    r.ms = millis();
+    r.seq = ds_mqtt_recorder.seq;
+    r.value = value;
+    r.type = type;
+    r.check = record_check(r);
+    ++ds_mqtt_recorder.seq;
+  }
+
+/*!
+* @return event seq if it is still in the ring and intact, else nullptr
+*/
+  static const ds_mqtt_record_t* recorded(uint16_t seq)
+  {
+    const ds_mqtt_record_t &r = ds_mqtt_recorder.records[seq % DS_MQTT_RECORDER_SIZE];
+    if (r.seq != seq || r.check != record_check(r)
+        || static_cast<uint16_t>(ds_mqtt_recorder.seq - seq - 1) >= DS_MQTT_RECORDER_SIZE)
+      return nullptr;
+    return &r;
+  }
+#endif
+
+  static constexpr int8_t NOT_SHOW = -1;
+  typedef void (*mqtt_msg_handler_t)(char*, uint8_t*, unsigned int);
+
+/*!
+* @brief transport policies, MQTT_manager's last template parameter
+* @detail a policy provides, all static so the calls are resolved
+*         at compile time:
+*           client_t          the Arduino Client PubSubClient runs over
+*           begin(ip_ending)  (re)starts the interface, 192.168.10.<ip_ending>
+*           hardware_ok()     false if the module is missing
+*           link_ok()         false if the link is down (cable, access point)
+*           local_ip()        for the console
+*           server()          the broker's address
+*         e.g. an ENC28J60 with UIPEthernet, whose API is the Ethernet one
+*         but reports neither the module nor the link:
+*           struct enc28j60 : ds_MQTT::w5500 {
+*             static bool hardware_ok() { return true; }
+*             static bool link_ok()     { return true; }
+*           };
+*/
+#if DS_MQTT_ETHERNET
+  struct w5500 {
+    typedef EthernetClient client_t;
+
+    static void begin(uint8_t ip_ending)
+    {
+      byte mac[] = {0x90, 0xA2, 0xDA, 0x10, 0xA9, ip_ending};
+      IPAddress ip(192, 168, 10, ip_ending);
+
+      Ethernet.begin(mac, ip);
+    }
+
+    static bool hardware_ok()     { return Ethernet.hardwareStatus() != EthernetNoHardware; }
+    static bool link_ok()         { return Ethernet.linkStatus() != LinkOFF; }
+    static IPAddress local_ip()   { return Ethernet.localIP(); }
+    static IPAddress server()     { return IPAddress(192, 168, 10, 1); }
+  };
+  typedef w5500 default_transport;
+#else
+/// no Ethernet library: MQTT_manager's transport is to be given
+  struct no_transport_without_ethernet;
+  typedef no_transport_without_ethernet default_transport;
+#endif
+
+#if defined(ESP32) || defined(ESP8266)
+/*!
+* @brief WiFi station with the W5500's addressing, the gateway is the broker
+* @detail begin() leaves a joined station as it is: it is called after
+*         every failed broker connect, and rejoining the access point
+*         then would only take the link down
+*/
+  template<const char *SSID, const char *PASSWORD>
+  struct wifi {
+    typedef WiFiClient client_t;
+
+    static void begin(uint8_t ip_ending)
+    {
+      if (WiFi.status() == WL_CONNECTED)
+        return;
+      WiFi.mode(WIFI_STA);
+      WiFi.config(IPAddress(192, 168, 10, ip_ending), server(), IPAddress(255, 255, 255, 0));
+      WiFi.begin(SSID, PASSWORD);
+    }
+
+    static bool hardware_ok()     { return true; }
+    static bool link_ok()         { return WiFi.status() == WL_CONNECTED; }
+    static IPAddress local_ip()   { return WiFi.localIP(); }
+    static IPAddress server()     { return IPAddress(192, 168, 10, 1); }
+  };
+#endif
+
+/*!
+* @brief the transport's client noting what PubSubClient reads but does
+*        not expose: CONNACK's session present flag and the PUBACKs
+* @detail follows the incoming packets' fixed headers, the bodies of
+*         the other packets are skipped whole; up to DS_MQTT_QOS1_WINDOW
+*         acknowledged ids are kept for pop_ack()
+*/
+  template<class C>
+  class session_client : public C {
+  public:
+    session_client() { _restart(); }
+
+    using C::connect;
+    virtual int connect(IPAddress ip, uint16_t port)
+    {
+      _restart();
+      return C::connect(ip, port);
+    }
+
+    virtual int connect(const char *host, uint16_t port)
+    {
+      _restart();
+      return C::connect(host, port);
+    }
+
+/// through read(buf, size), which the clients (Ethernet, WiFi, UIPEthernet,
+/// linux/) implement without read(), so every byte is snooped once
+    virtual int read()
+    {
+      uint8_t b;
+      return read(&b, 1) == 1 ? b : -1;
+    }
+
+    virtual int read(uint8_t *buf, size_t size)
+    {
+      int n = C::read(buf, size);
+      for (int i = 0; i < n; ++i) {
+        if (_state == BODY && _type != CONNACK && _type != PUBACK) {
+          uint32_t skip = static_cast<uint32_t>(n - i) < _remaining ? n - i : _remaining;
+          _remaining -= skip;
+          i += skip - 1;
+          if (_remaining == 0)
+            _state = HEADER;
+          continue;
+        }
+        _snoop(buf[i]);
+      }
+      return n;
+    }
+
+    bool session_present() const { return _sessionPresent; }
+
+/*!
+* @brief takes the oldest acknowledged packet id
+* @return false if there is none
+*/
+    bool pop_ack(uint16_t &id)
+    {
+      if (_ackCount == 0)
+        return false;
+      id = _acks[0];
+      --_ackCount;
+      memmove(_acks, _acks + 1, _ackCount * sizeof(_acks[0]));
+      return true;
+    }
+
+  private:
+    enum snoop_states { HEADER, LENGTH, BODY };
+    static constexpr uint8_t CONNACK = 2U;
+    static constexpr uint8_t PUBACK  = 4U;
+
+    void _restart()
+    {
+      _state = HEADER;
+      _sessionPresent = false;
+      _ackCount = 0;
+    }
+
+    void _snoop(uint8_t b)
+    {
+      switch (_state) {
+      case HEADER:
+        _type = b >> 4;
+        _remaining = 0;
+        _shift = 0;
+        _pos = 0;
+        _state = LENGTH;
+        break;
+      case LENGTH:
+        _remaining |= static_cast<uint32_t>(b & 0x7F) << _shift;
+        _shift += 7;
+        if (!(b & 0x80))
+          _state = _remaining ? BODY : HEADER;
+        break;
+      case BODY:
+        if (_type == CONNACK && _pos == 0)
+          _sessionPresent = b & 0x01;
+        if (_type == PUBACK && _pos < 2)
+          _id = _pos == 0 ? b << 8 : _id | b;
+        if (_type == PUBACK && _pos == 1 && _ackCount < DS_MQTT_QOS1_WINDOW)
+          _acks[_ackCount++] = _id;
+        ++_pos;
+        if (--_remaining == 0)
+          _state = HEADER;
+        break;
+      }
+    }
+
+    uint8_t  _state;
+    uint8_t  _type;
+    uint8_t  _shift;
+    uint8_t  _pos;
+    uint32_t _remaining;
+    uint16_t _id;
+    bool     _sessionPresent;
+    uint8_t  _ackCount;
+    uint16_t _acks[DS_MQTT_QOS1_WINDOW];
+  };
+
+#if DS_MQTT_THREADED
+/*!
+* @brief lock-free ring for a single producer and a single consumer thread
+* @detail items are filled and read in place: back() + push() on the
+*         producer's side, front() + pop() on the consumer's one;
+*         holds N - 1 items
+*/
+  template<typename T, size_t N>
+  class spsc_queue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+  public:
+    spsc_queue(): _head(0), _tail(0) {}
+
+/*!
+* @return the slot to fill, nullptr if the queue is full
+*/
+    T* back()
+    {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      if (((tail + 1) & (N - 1)) == _head.load(std::memory_order_acquire))
+        return nullptr;
+      return &_items[tail];
+    }
+
+    void push()
+    {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      _tail.store((tail + 1) & (N - 1), std::memory_order_release);
+    }
+
+/*!
+* @return the oldest item, nullptr if the queue is empty
+*/
+    T* front()
+    {
+      size_t head = _head.load(std::memory_order_relaxed);
+      if (head == _tail.load(std::memory_order_acquire))
+        return nullptr;
+      return &_items[head];
+    }
+
+    void pop()
+    {
+      size_t head = _head.load(std::memory_order_relaxed);
+      _head.store((head + 1) & (N - 1), std::memory_order_release);
+    }
+
+  private:
+    T _items[N];
+    alignas(64) std::atomic<size_t> _head;  /// < the consumer's
+    alignas(64) std::atomic<size_t> _tail;  /// < the producer's
+  };
+#endif
+};
+
+/*!
+* @class MQTT_manager 
+* @brief Facade class to use mqtt protocol via ethernet
+* @param [in] size_t props_count number of props operating on the circuit
+* @param [in] CLIENT_NAME unique id of the circuit
+* @param [in] props_STRIDS array of props' names
+* @param [in] er_onStart procedure called on ERP Start Game cmd
+* @param [in] er_onReset procedure called on ERP Reset All cmd
+* @param [in] props_CBs array of each prop callbacks (onActivate, OnFinish, onReset)
+* @param [in] special_CB pointer to a procedure to process a mqtt_msg in a custom way;
+*            its payload is zero terminated (payload[length] == 0), a payload
+*            of MQTT_MAX_PACKET_SIZE bytes or more (PubSubClient's buffer raised
+*            by setBufferSize()) is dropped and counted as an error; with
+*            DS_MQTT_THREADED the queue drops one of BUF_SIZE bytes or more
+* @param [in] transport network policy, see ds_MQTT::w5500
+* @warning props_CBs has to contatin props_count arrays
+           of each prop's callbacks (3 CBs for each prop)
+* @todo reorder data fields for memory align
+* @example
+*            Console *consOLE = new Console();
+*
+*            constexpr size_t PROPS_NUM = 3;
+*            constexpr char strID[] = "box_yammychoco_mokka_EK$$$";
+*
+*            const char rname1[] = "box"; //> will be shown in ERP as "Box"
+*            const char rname2[] = "yammy_choco"; //> will be shown in ERP as "Yammy choco"
+*            const char rname3[] = "_mokka"; // not to be shown in the ERP because of prefix '_'
+*            const char *propsNames[PROPS_NUM] = {rname1, rname2, rname3};
+*            constexpr int riddles_num_in_ERP[PROPS_NUM] = {2,5,8};
+*
+*            void onSrt() {} void onRst() {}
+*            void r1a() {} void r1f() {} void r1r() {}
+*            void r2a() {} void r2f() {} void r2r() {}
+*            void r3a() {} void r3f() {} void r3r() {}
+*            void my_special_cb(char* topic, uint8_t* payload, unsigned int len)
+*            { if (strcmp(topic, "/er/music/cmd")) do_something(); }
+*
+*            prop_CBs_t prop1 = { r1a, r1f, r1r };
+*            prop_CBs_t prop2 = { r2a, r2f, r2r };
+*            prop_CBs_t prop3 = { r3a, r3f, r3r };
+*            props_CBs_t props_cbs[PROPS_NUM] = { &prop1, &prop2, &prop3};
+*
+*
+*            prop_state_t boxState   = {0};
+*            prop_state_t chocoState = {0};
+*            prop_state_t mokkaState = {0};
+*            props_states_t props_states[PROPS_NUM] = {boxState, chocoState, mokkaState};
+*
+*            ...
+*            auto *manag = new MQTT_manager< PROPS_NUM, strID, propsNames, riddles_num_in_ERP,
+*                                            onSrt, onRst, props_cbs>(consOLE);
+*            ...
+*            manag->check();
+*            ...
+*            manag->publish("hi", "there");
+*            ...
+*            manag->sendInfoLoop(props_states);
+*            ...
+*/
+template<size_t props_count,
+         const char* CLIENT_NAME,     /// client_name is for PROP_NAME
+         const char** props_STRIDS,   /// for STRIDs
+         const int* mqtt_numbers,     /// for props' numbers in ERP
+         void (*er_onStart)(),
+         void (*er_onReset)(),
+         props_CBs_t *props_CBs,
+         void (*special_CB)(char*, uint8_t*, unsigned int) = nullptr,
+         const char** extra_topics = nullptr,
+         const size_t extra_topics_count = 0,
+         class transport = ds_MQTT::default_transport>
+class MQTT_manager
+{
+public:
+/*!
+* @brief MQTT_manager constructor
+* @detail setup a client, server, callback for received msgs
+* @param [in] console pointer to out stream Strategy object
+* @param [in] ip_ending necessary for Ethernet static object (Singleton)
+* @param [in] mqqt_port server port for PubSubClient (this class' field)
+* @todo shrink it
+* @todo replace the hardcode
+*/
+  explicit MQTT_manager(const Console *console,
+                        const byte ip_ending,
+                        const size_t &mqtt_port = 1883):
+    _console(console),
+    _server(transport::server()),
+    _lastReconnectAttempt(0),
+    _ip_ending(ip_ending),
+    _loopLastUs(0),
+    _loopSumUs(0),
+    _loopMaxUs(0),
+    _loopCount(0),
+    _minFreeRam(ds_MQTT::free_ram())
+  {
+    DS_MQTT_LOG_I(_console->println(F("Initializing Ethernet...")));
+    _startEthernet();
+    DS_MQTT_LOG_I(_console->print(F("Local IP: ")));
+    DS_MQTT_LOG_I(_console->println(transport::local_ip()));
+    DS_MQTT_LOG_I(_console->println(F("Ethernet Initialized...")));
+    _client.setClient(_netClient);
+    _client.setServer(_server, mqtt_port);
+    _client.setCallback(default_msg_handler);
+#if DS_MQTT_CYCLES
+    ds_MQTT::cycles_start();
+#endif
+#if DS_MQTT_PROFILE
+    _profileReset();
+#endif
+#if DS_MQTT_SAMPLER
+    ds_MQTT::sampler_start();
+#endif
+#if DS_MQTT_RECORDER
+    ds_MQTT::recorder_start();
+    _recordsSent() = ds_mqtt_recorder.seq - DS_MQTT_RECORDER_SIZE;
+#ifdef __AVR__
+    ds_MQTT::record(ds_MQTT::REC_BOOT, ds_mqtt_reset_flags);
+#else
+    ds_MQTT::record(ds_MQTT::REC_BOOT);
+#endif
+#endif
+    for (size_t i = 0; i < props_count; ++i) {
+      bool safe = props_STRIDS[i] == nullptr || ds_MQTT::json_safe(props_STRIDS[i]);
+      _escapes[i] = safe ? 0 : ESCAPE_ID;
+    }
+#if DS_MQTT_OWN_STATES
+    for (size_t i = 0; i < props_count; ++i) {
+      strcpy(_states[i], MQTT_STRSTATUS_READY);
+      _statesPtrs[i] = _states[i];
+    }
+#endif
+#if DS_MQTT_DIRTY
+    memset(_shown, 0, sizeof(_shown));
+    for (size_t i = 0; i < props_count; ++i) {
+      if (_isShown(i))
+        _shown[i / DIRTY_WORD_BITS] |= 1UL << (i % DIRTY_WORD_BITS);
+    }
+    memcpy(_dirty, _shown, sizeof(_dirty));
+#endif
+#if DS_MQTT_DIRTY && DS_MQTT_QOS1
+    memset(_changed, 0, sizeof(_changed));
+#endif
+    delay(1500);
+  }
+
+/*!
+* @brief a procedure to be called in loop
+* @param props_states props' current states
+* @warning props_states' elements' number must be equal to props_count
+* @detail calls methods: _check, _sendInfoLoop, _sendHealthLoop
+*         and _serveDiag
+*/
+  void routine(const char *const *props_states)
+  {
+    _loopStats();
+    _check();
+#if DS_MQTT_QOS1
+    _qos1Loop();
+#endif
+    _sendInfoLoop(props_states);
+    _sendHealthLoop();
+    _serveDiag();
+  }
+
+#if DS_MQTT_OWN_STATES
+/*!
+* @brief routine() on the states set by setState,
+*        with DS_MQTT_THREADED to be called in the network thread
+*/
+  void routine()
+  {
+#if DS_MQTT_THREADED
+    state_update_t *update;
+    while ((update = _stateUpdates().front()) != nullptr) {
+      if (update->prop < props_count)
+        _applyState(update->prop, update->state);
+      _stateUpdates().pop();
+    }
+#endif
+#if DS_MQTT_DIRTY
+    _loopStats();
+    _check();
+#if DS_MQTT_QOS1
+    _qos1Loop();
+#endif
+    _sendChangedLoop();
+    _sendHealthLoop();
+    _serveDiag();
+#else
+    routine(_statesPtrs);
+#endif
+  }
+
+/*!
+* @brief sets prop i's state for the info msgs, with DS_MQTT_THREADED
+*        queues it and is to be called in the prop logic thread
+* @return false if the queue is full, to be retried
+*/
+  bool setState(size_t i, const char *state)
+  {
+#if DS_MQTT_THREADED
+    state_update_t *update = _stateUpdates().back();
+    if (!update)
+      return false;
+    update->prop = i;
+    strncpy(update->state, state, PROP_STATUS_MAX_SIZE - 1);
+    update->state[PROP_STATUS_MAX_SIZE - 1] = 0;
+    _stateUpdates().push();
+#else
+    if (i < props_count)
+      _applyState(i, state);
+#endif
+    return true;
+  }
+#endif
+
+#if DS_MQTT_THREADED
+/*!
+* @brief runs the callbacks of the queued commands, in the prop logic thread
+* @return number of the commands run
+*/
+  static size_t dispatch()
+  {
+    size_t n = 0;
+    command_t *cmd;
+    while ((cmd = _commands().front()) != nullptr) {
+      _dispatch(cmd->topic, cmd->payload, cmd->length);
+      _commands().pop();
+      ++n;
+    }
+    return n;
+  }
+#endif
+
+/*!
+* @brief decorator providing access to mqtt publish interface
+* @param [in] topic kind of address
+* @param [in] payload the msg itself
+* @param [in] retained if true the value is supposed to be kept on mqtt server
+* @return bool true if published and false otherwise
+*/
+  bool publish(const char* topic, const char* payload, bool retained = false)
+  {
+#if DS_MQTT_TRACE
+    _traceAdd(TRACE_OUT, topic, strlen(payload));
+#endif
+    return _client.publish(topic, payload, retained);
+  }
+
+#if DS_MQTT_QOS1
+/*!
+* @brief publishes at QoS 1, resending until the broker acknowledges it
+* @return false if not connected, the window is full (to be retried),
+*         the packet does not fit DS_MQTT_QOS1_PACKET or was cut short
+*         (the connection is dropped then)
+*/
+  bool publish_qos1(const char* topic, const char* payload, bool retained = false)
+  {
+    inflight_t *slot = _qos1Slot();
+    if (!slot || !_client.connected())
+      return false;
+
+    size_t topicLength = strlen(topic);
+    size_t payloadLength = strlen(payload);
+    size_t remaining = 2 + topicLength + 2 + payloadLength;
+    if (remaining + 3 > DS_MQTT_QOS1_PACKET || remaining > 16383)
+      return false;
+
+    uint8_t *p = slot->packet;
+    *p++ = 0x32 | (retained ? 1 : 0);            /// < PUBLISH, QoS 1
+    if (remaining > 127) {
+      *p++ = (remaining & 0x7F) | 0x80;
+      *p++ = remaining >> 7;
+    } else {
+      *p++ = remaining;
+    }
+    *p++ = topicLength >> 8;
+    *p++ = topicLength & 0xFF;
+    memcpy(p, topic, topicLength);
+    p += topicLength;
+
+    qos1_t &qos1 = _qos1();
+    if (++qos1.nextId == 0)
+      qos1.nextId = 1;
+    slot->id = qos1.nextId;
+    *p++ = slot->id >> 8;
+    *p++ = slot->id & 0xFF;
+    memcpy(p, payload, payloadLength);
+    p += payloadLength;
+
+    slot->length = p - slot->packet;
+    slot->sentAt = millis();
+#if DS_MQTT_TRACE
+    _traceAdd(TRACE_OUT, topic, payloadLength);
+#endif
+    if (!_qos1Write(*slot)) {
+      slot->length = 0;
+      return false;
+    }
+    return true;
+  }
+#endif
+
+  bool is_connected()
+  {
+    return _client.connected();
+  }
+
+  MQTT_manager(const MQTT_manager&)             = delete;
+  MQTT_manager(MQTT_manager&&)                  = delete;
+  MQTT_manager& operator=(const MQTT_manager&)  = delete;
+  MQTT_manager& operator=(MQTT_manager&&)       = delete;
+
+  friend struct ds_mqtt_host;  /// < the host harnesses' entry points, see fuzz/ and bench/
+
+private:
+/// the longest health msg with the enabled fields and a CLIENT_NAME of up to 32 chars
+  static constexpr size_t HEALTH_MAX_SIZE =
+    128U + 32U + (DS_MQTT_STACK_PAINT ? 16U : 0U) + (DS_MQTT_DEDUP ? 17U : 0U) +
+    (DS_MQTT_INFO_ADAPTIVE ? 16U : 0U) + (DS_MQTT_QOS1 ? 20U : 0U) + (DS_MQTT_THREADED ? 19U : 0U);
+  static constexpr size_t BUF_SIZE                   = HEALTH_MAX_SIZE > 160U ? HEALTH_MAX_SIZE : 160U;
+  static constexpr size_t ON_CONNECTED_BUF_MAX_SIZE  = 32U;
+
+/*!
+* @brief buffers shared by all the call paths instead of stack ones
+* @detail msg is for rendering payloads, topic is for building topics;
+*         routine() is not reentrant and none of the paths nests another
+*         one using the same buffer, so a single set is enough
+*/
+  struct buffers_t {
+    char msg[BUF_SIZE];
+    char topic[ON_CONNECTED_BUF_MAX_SIZE];
+    bool msgCut;  /// < _msgAdd ran out of msg since _msgStart
+  };
+  static buffers_t _buf;
+
+/*!
+* @brief builds "/er/<prop STRID>/cmd" in _buf.topic
+* @param [in] i prop's index
+* @return _buf.topic or nullptr if the STRID is longer than
+*         ON_CONNECTED_BUF_MAX_SIZE - 9 chars and the topic does not fit
+*/
+  static const char* _propTopic(size_t i)
+  {
+    strcpy(_buf.topic, "/er/");
+    if (!ds_MQTT::append(_buf.topic, ON_CONNECTED_BUF_MAX_SIZE, props_STRIDS[i]) ||
+        !ds_MQTT::append(_buf.topic, ON_CONNECTED_BUF_MAX_SIZE, "/cmd"))
+      return nullptr;
+    return _buf.topic;
+  }
+
+/*!
+* @brief appends to _buf.msg, truncating at its end and noting it in _buf.msgCut
+*/
+  static void _msgAdd(const char *src)
+  {
+    if (!ds_MQTT::append(_buf.msg, BUF_SIZE, src))
+      _buf.msgCut = true;
+  }
+
+/*!
+* @brief starts a diagnostics msg in _buf.msg: {"id":"<CLIENT_NAME>
+*/
+  static void _msgStart()
+  {
+    static const bool safe = ds_MQTT::json_safe(CLIENT_NAME);
+    strcpy(_buf.msg, "{\"id\":\"");
+    _buf.msgCut = false;
+    if (safe)
+      _msgAdd(CLIENT_NAME);
+    else if (!ds_MQTT::append_json(_buf.msg, BUF_SIZE, CLIENT_NAME))
+      _buf.msgCut = true;
+  }
+
+/*!
+* @brief finds the prop a msg topic is addressed to
+* @detail takes the <id> of "/er/<id>/cmd" and compares it with the
+*         props' ids in place: with DS_MQTT_THREADED it runs in the prop
+*         logic thread, so it must not touch _buf
+* @param [in] topic msg topic
+* @return index of the prop having callbacks or -1
+*/
+  static int _propIndex(const char *topic)
+  {
+    size_t length = strlen(topic);
+    if (length <= 8 || strncmp(topic, "/er/", 4) != 0 || strcmp(topic + length - 4, "/cmd") != 0)
+      return -1;
+    const char *id = topic + 4;
+    length -= 8;
+
+    for (size_t i = 0; i < props_count; ++i) {
+      if (props_CBs[i] != nullptr && props_STRIDS[i] != nullptr
+          && strncmp(id, props_STRIDS[i], length) == 0 && props_STRIDS[i][length] == 0)
+        return i;
+    }
+    return -1;
+  }
+
+/*!
+* @brief checks if the prop is to be shown in ERP
+* @param [in] i prop's index
+*/
+  static bool _isShown(size_t i)
+  {
+    if (props_STRIDS[i] == nullptr) /// < means no need to public in ERP
+      return false;
+
+    if (props_STRIDS[i][0] == '_' || mqtt_numbers[i] < 0) /// < todo: delete '_'
+      return false;
+
+    return true;
+  }
+
+/*!
+* @brief PubSubClient's callback: runs the commands' callbacks or,
+*        with DS_MQTT_THREADED, queues them for dispatch()
+*/
+  static void default_msg_handler(char* topic, uint8_t* payload, unsigned int length)
+  {
+    prof_scope_t scope(PROF_DISPATCH);
+    trace_scope_t trace(topic, payload, length);
+#if DS_MQTT_DEDUP
+    if (_isDuplicate(topic, payload, length)) {
+      ++_dedup().dropped;
+      trace.dedup(payload, length, true);
+      return;
+    }
+    trace.dedup(payload, length, false);
+#endif
+#if DS_MQTT_RECORDER
+    _recordCommand(topic, payload, length);
+#endif
+#if DS_MQTT_INFO_ADAPTIVE
+    if (!DS_MQTT_DIAG || strcmp(topic, "/er/diag") != 0)
+      _heartbeatBoost();
+#endif
+#if DS_MQTT_THREADED
+    if (DS_MQTT_DIAG && strcmp(topic, "/er/diag") == 0) {
+      _onDiag(payload, length);
+      return;
+    }
+    _enqueue(topic, payload, length);
+#else
+    _dispatch(topic, payload, length);
+#endif
+  }
+
+  static void _dispatch(char* topic, uint8_t* payload, unsigned int length);
+
+#if !DS_MQTT_THREADED
+/*!
+* @brief special_CB's payload copy when it does not fit _buf.msg
+* @detail sized to PubSubClient's default buffer, so it holds any payload
+*         PubSubClient received unless setBufferSize() raised that buffer
+*/
+  static char* _specialPayload()
+  {
+    static char payload[MQTT_MAX_PACKET_SIZE];
+    return payload;
+  }
+#endif
+
+  enum verbs { VERB_OTHER, VERB_ACTIVATE, VERB_FINISH, VERB_RESET, VERB_START, VERBS_NUM };
+
+/*!
+* @brief the command a payload is, for the recorder and the trace
+*/
+  static uint8_t _verb(const uint8_t *payload, unsigned int length)
+  {
+    if (ds_MQTT::payload_is(payload, length, "activate"))
+      return VERB_ACTIVATE;
+    if (ds_MQTT::payload_is(payload, length, "finish"))
+      return VERB_FINISH;
+    if (ds_MQTT::payload_is(payload, length, "reset"))
+      return VERB_RESET;
+    if (ds_MQTT::payload_is(payload, length, "start"))
+      return VERB_START;
+    return VERB_OTHER;
+  }
+
+  enum trace_dirs { TRACE_IN, TRACE_OUT };
+
+#if DS_MQTT_TRACE
+  struct trace_t {
+    unsigned long ms;
+    uint32_t      topic;  /// < ds_MQTT::hash of the topic
+    uint16_t      length;
+    uint16_t      us;     /// < msg handler's time, inbound only
+    int16_t       prop;   /// < inbound only, else -1
+    uint8_t       dir;
+    uint8_t       verb;
+    bool          dup;    /// < dropped as a duplicate
+  };
+
+/*!
+* @brief msgs ring, entries[seq % DS_MQTT_TRACE_SIZE] is the next one
+*/
+  struct trace_ring_t {
+    trace_t       entries[DS_MQTT_TRACE_SIZE];
+    unsigned long seq;
+    bool          paused;  /// < while dumping, not to trace the dump
+  };
+
+  static trace_ring_t& _trace()
+  {
+    static trace_ring_t trace;
+    return trace;
+  }
+
+/*!
+* @brief adds a msg to the trace
+* @return its seq
+*/
+  static unsigned long _traceAdd(uint8_t dir, const char *topic, size_t length)
+  {
+    trace_ring_t &trace = _trace();
+    if (trace.paused)
+      return trace.seq - 1;
+    trace_t &entry = trace.entries[trace.seq % DS_MQTT_TRACE_SIZE];
+    entry.ms = millis();
+    entry.topic = ds_MQTT::hash(reinterpret_cast<const uint8_t*>(topic), strlen(topic));
+    entry.length = length > 0xFFFF ? 0xFFFF : length;
+    entry.us = 0;
+    entry.prop = -1;
+    entry.dir = dir;
+    entry.verb = VERB_OTHER;
+    entry.dup = false;
+    return trace.seq++;
+  }
+#endif
+
+/*!
+* @brief guard tracing an inbound msg with its handling time;
+*        compiles to nothing unless DS_MQTT_TRACE
+*/
+  class trace_scope_t {
+  public:
+#if DS_MQTT_TRACE
+    trace_scope_t(const char *topic, const uint8_t *payload, unsigned int length):
+      _seq(_traceAdd(TRACE_IN, topic, length)),
+      _start(micros())
+    {
+      trace_t &entry = _trace().entries[_seq % DS_MQTT_TRACE_SIZE];
+      entry.prop = _propIndex(topic);
+      entry.verb = _verb(payload, length);
+    }
+
+/*!
+* @brief notes what the dedup made of the msg: the verb without the
+*        "#<seq>" suffix it cut and whether the msg was dropped
+*/
+    void dedup(const uint8_t *payload, unsigned int length, bool dropped)
+    {
+      trace_t &entry = _trace().entries[_seq % DS_MQTT_TRACE_SIZE];
+      entry.verb = _verb(payload, length);
+      entry.dup = dropped;
+    }
+
+    ~trace_scope_t()
+    {
+      unsigned long spent = micros() - _start;
+      trace_ring_t &trace = _trace();
+      if (trace.seq - _seq <= DS_MQTT_TRACE_SIZE)  /// < not overwritten by the callbacks' publishes
+        trace.entries[_seq % DS_MQTT_TRACE_SIZE].us = spent > 0xFFFF ? 0xFFFF : spent;
+    }
+
+  private:
+    unsigned long _seq;
+    unsigned long _start;
+#else
+    trace_scope_t(const char*, const uint8_t*, unsigned int) {}
+    void dedup(const uint8_t*, unsigned int, bool) {}
+#endif
+  };
+
+#if DS_MQTT_RECORDER
+/*!
+* @brief records a prop's or /er/cmd's command, in the network thread
+*/
+  static void _recordCommand(const char *topic, const uint8_t *payload, unsigned int length)
+  {
+    static const uint8_t types[VERBS_NUM] = {
+      ds_MQTT::REC_COMMAND, ds_MQTT::REC_ACTIVATE, ds_MQTT::REC_FINISH,
+      ds_MQTT::REC_RESET, ds_MQTT::REC_START
+    };
+    int i = _propIndex(topic);
+    if (i < 0 && strcmp(topic, "/er/cmd") != 0)
+      return;
+    ds_MQTT::record(types[_verb(payload, length)], i < 0 ? ds_MQTT::RECORD_NO_PROP : i);
+  }
+
+/*!
+* @brief the seq of the first event not published yet
+*/
+  static uint16_t& _recordsSent()
+  {
+    static uint16_t sent = 0;
+    return sent;
+  }
+
+/*!
+* @brief publishes the events recorded since the last call (or the
+*        whole ring after boot), stops at a failed publish
+*/
+  void _sendRecords()
+  {
+    char num[12];
+    uint16_t &sent = _recordsSent();
+    for (; sent != ds_mqtt_recorder.seq; ++sent) {
+      const ds_mqtt_record_t *r = ds_MQTT::recorded(sent);
+      if (r == nullptr)
+        continue;
+      _msgStart();
+      _msgAdd("\",\"rec\":\"");
+      _msgAdd(ds_MQTT::record_name(r->type));
+      _msgAdd("\",\"seq\":");
+      _msgAdd(ultoa(r->seq, num, 10));
+      _msgAdd(",\"ms\":");
+      _msgAdd(ultoa(r->ms, num, 10));
+      _msgAdd(",\"v\":");
+      _msgAdd(ltoa(static_cast<int16_t>(r->value), num, 10));
+      _msgAdd("}");
+      if (!this->publish("/er/diag/info", _buf.msg))
+        return;
+    }
+  }
+#endif
+
+#if DS_MQTT_QOS1
+/*!
+* @brief a QoS 1 publish awaiting its PUBACK, length 0 marks a free slot
+*/
+  struct inflight_t {
+    uint8_t       packet[DS_MQTT_QOS1_PACKET];
+    uint16_t      length;
+    uint16_t      id;
+    unsigned long sentAt;   /// < ms
+  };
+
+  struct qos1_t {
+    inflight_t    window[DS_MQTT_QOS1_WINDOW];
+    uint16_t      nextId;
+    unsigned long resent;
+  };
+
+  static qos1_t& _qos1()
+  {
+    static qos1_t qos1;
+    return qos1;
+  }
+
+/*!
+* @brief writes a slot's packet whole
+* @detail a short write, e.g. on a full W5500 transmit buffer, would
+*         leave a partial PUBLISH misframing the rest of the stream, so
+*         it drops the connection
+* @return false if it was cut short
+*/
+  bool _qos1Write(const inflight_t &slot)
+  {
+    if (_netClient.write(slot.packet, slot.length) == slot.length)
+      return true;
+    ++_errors();
+    DS_MQTT_LOG_E(_console->println(F("MQTT: short QoS 1 write, dropping the connection")));
+    _netClient.stop();
+    return false;
+  }
+
+  static inflight_t* _qos1Slot()
+  {
+    for (uint8_t k = 0; k < DS_MQTT_QOS1_WINDOW; ++k) {
+      if (_qos1().window[k].length == 0)
+        return &_qos1().window[k];
+    }
+    return nullptr;
+  }
+
+/*!
+* @brief frees the acknowledged slots and resends the timed out ones
+* @detail called after _check, whose _client.loop() reads the PUBACKs
+*/
+  void _qos1Loop()
+  {
+    qos1_t &qos1 = _qos1();
+    uint16_t id;
+    while (_netClient.pop_ack(id)) {
+      for (uint8_t k = 0; k < DS_MQTT_QOS1_WINDOW; ++k) {
+        if (qos1.window[k].length == 0 || qos1.window[k].id != id)
+          continue;
+#if DS_MQTT_INFO_ADAPTIVE
+        if (!(qos1.window[k].packet[0] & 0x08)) {  /// < a resent one's RTT is ambiguous
+          long rtt = millis() - qos1.window[k].sentAt;
+          _heartbeat().rtt += (rtt - static_cast<long>(_heartbeat().rtt)) / 4;
+          _heartbeat().acked = true;
+        }
+#endif
+        qos1.window[k].length = 0;
+      }
+    }
+
+    if (!_client.connected())
+      return;
+
+    for (uint8_t k = 0; k < DS_MQTT_QOS1_WINDOW; ++k) {
+      inflight_t &slot = qos1.window[k];
+      if (slot.length == 0 || millis() - slot.sentAt <= DS_MQTT_QOS1_TIMEOUT)
+        continue;
+      slot.packet[0] |= 0x08;                    /// < DUP
+      slot.sentAt = millis();
+      ++qos1.resent;
+      if (!_qos1Write(slot))
+        return;       /// < kept, its first copy is still unacknowledged
+    }
+  }
+#endif
+
+#if DS_MQTT_DEDUP
+  static constexpr uint32_t DEDUP_SEQ = 0x80000000UL;  /// < marks seq keys
+
+/*!
+* @brief the recently run commands: keys are "#<seq>" numbers with
+*        DEDUP_SEQ set or hashes of topic and payload
+*/
+  struct dedup_t {
+    uint32_t      keys[DS_MQTT_DEDUP_SIZE];
+    unsigned long times[DS_MQTT_DEDUP_SIZE];  /// < ms
+    uint8_t       next;
+    unsigned long dropped;
+  };
+
+  static dedup_t& _dedup()
+  {
+    static dedup_t dedup;
+    return dedup;
+  }
+
+/*!
+* @brief checks a command against the recent ones and remembers it
+* @param [in,out] length cut to drop a command's "#<seq>" suffix
+* @return true if it is to be dropped
+*/
+  static bool _isDuplicate(const char *topic, const uint8_t *payload, unsigned int &length)
+  {
+    if (DS_MQTT_DIAG && strcmp(topic, "/er/diag") == 0)
+      return false;
+
+    /// only the ERP's commands carry "#<seq>", other payloads are not touched
+    const bool command = strcmp(topic, "/er/cmd") == 0 || _propIndex(topic) >= 0;
+    uint32_t key = 0;
+    unsigned int i = length;
+    while (command && i > 0 && payload[i - 1] >= '0' && payload[i - 1] <= '9' && length - i < 9)
+      --i;
+    if (command && i > 0 && i < length && payload[i - 1] == '#') {
+      for (unsigned int k = i; k < length; ++k)
+        key = key * 10 + (payload[k] - '0');
+      key |= DEDUP_SEQ;
+      length = i - 1;
+    } else {
+      key = ds_MQTT::hash(reinterpret_cast<const uint8_t*>(topic), strlen(topic));
+      key = ds_MQTT::hash(payload, length, key) & ~DEDUP_SEQ;
+    }
+
+    dedup_t &dedup = _dedup();
+    unsigned long now = millis();
+    for (uint8_t k = 0; k < DS_MQTT_DEDUP_SIZE; ++k) {
+      if (dedup.keys[k] != key || (key == 0 && dedup.times[k] == 0))
+        continue;
+      if (now - dedup.times[k] <= (key & DEDUP_SEQ ? DS_MQTT_DEDUP_SEQ_WINDOW : DS_MQTT_DEDUP_WINDOW))
+        return true;
+    }
+
+    dedup.keys[dedup.next] = key;
+    dedup.times[dedup.next] = now;
+    dedup.next = (dedup.next + 1) % DS_MQTT_DEDUP_SIZE;
+    return false;
+  }
+#endif
+
+#if DS_MQTT_THREADED
+/*!
+* @brief a command for the prop logic thread, zero terminated copies
+*/
+  struct command_t {
+    char         topic[BUF_SIZE];
+    uint8_t      payload[BUF_SIZE];
+    unsigned int length;
+  };
+
+  struct state_update_t {
+    size_t       prop;
+    prop_state_t state;
+  };
+
+  static ds_MQTT::spsc_queue<command_t, DS_MQTT_QUEUE_SIZE>& _commands()
+  {
+    static ds_MQTT::spsc_queue<command_t, DS_MQTT_QUEUE_SIZE> queue;
+    return queue;
+  }
+
+  static ds_MQTT::spsc_queue<state_update_t, DS_MQTT_QUEUE_SIZE>& _stateUpdates()
+  {
+    static ds_MQTT::spsc_queue<state_update_t, DS_MQTT_QUEUE_SIZE> queue;
+    return queue;
+  }
+
+/*!
+* @brief commands dropped since boot: the queue was full or they did not fit
+*/
+  static unsigned long& _queueDrops()
+  {
+    static unsigned long drops = 0;
+    return drops;
+  }
+
+  static void _enqueue(const char *topic, const uint8_t *payload, unsigned int length)
+  {
+    command_t *cmd = _commands().back();
+    size_t topicLength = strlen(topic);
+    if (!cmd || topicLength >= BUF_SIZE || length >= BUF_SIZE) {
+      ++_queueDrops();
+      return;
+    }
+    memcpy(cmd->topic, topic, topicLength + 1);
+    memcpy(cmd->payload, payload, length);
+    cmd->payload[length] = 0;
+    cmd->length = length;
+    _commands().push();
+  }
+#endif
+
+  enum diag_requests {
+    DIAG_PROFILE = 1, DIAG_PROFILE_RESET = 2,
+    DIAG_SAMPLES = 4, DIAG_SAMPLES_RESET = 8,
+    DIAG_BENCH = 16, DIAG_TRACE = 32
+  };
+
+/*!
+* @brief diagnostics requested via /er/diag, served by _serveDiag
+* @detail requests are not served in the msg handler since publishing
+*         there overwrites PubSubClient's buffer with topic and payload
+*/
+  static uint8_t& _diagRequests()
+  {
+    static uint8_t requests = 0;
+    return requests;
+  }
+
+/*!
+* @brief parses a /er/diag payload into a request
+* @param [in] payload msg payload
+* @param [in] length payload's length
+*/
+  static void _onDiag(const uint8_t *payload, unsigned int length)
+  {
+    if (DS_MQTT_PROFILE && ds_MQTT::payload_is(payload, length, "profile"))
+      _diagRequests() |= DIAG_PROFILE;
+    else if (DS_MQTT_PROFILE && ds_MQTT::payload_is(payload, length, "profile_reset"))
+      _diagRequests() |= DIAG_PROFILE_RESET;
+    else if (DS_MQTT_SAMPLER && ds_MQTT::payload_is(payload, length, "samples"))
+      _diagRequests() |= DIAG_SAMPLES;
+    else if (DS_MQTT_SAMPLER && ds_MQTT::payload_is(payload, length, "samples_reset"))
+      _diagRequests() |= DIAG_SAMPLES_RESET;
+    else if (DS_MQTT_BENCH && ds_MQTT::payload_is(payload, length, "bench"))
+      _diagRequests() |= DIAG_BENCH;
+    else if (DS_MQTT_TRACE && ds_MQTT::payload_is(payload, length, "trace"))
+      _diagRequests() |= DIAG_TRACE;
+  }
+
+/*!
+* @brief serves diagnostics requested since the last call
+*/
+  void _serveDiag()
+  {
+    uint8_t requests = _diagRequests();
+    if (requests == 0)
+      return;
+    _diagRequests() = 0;
+
+#if DS_MQTT_PROFILE
+    if (requests & DIAG_PROFILE)
+      _sendProfile();
+    if (requests & DIAG_PROFILE_RESET)
+      _profileReset();
+#endif
+#if DS_MQTT_SAMPLER
+    if (requests & DIAG_SAMPLES)
+      _sendSamples();
+    if (requests & DIAG_SAMPLES_RESET)
+      ds_MQTT::sampler_reset();
+#endif
+#if DS_MQTT_BENCH
+    if (requests & DIAG_BENCH)
+      _bench();
+#endif
+#if DS_MQTT_TRACE
+    if (requests & DIAG_TRACE)
+      _sendTrace();
+#endif
+  }
+
+#if DS_MQTT_TRACE
+/*!
+* @brief dumps the trace, see DS_MQTT_TRACE
+*/
+  void _sendTrace()
+  {
+    static const char *const verbs[VERBS_NUM] = { "", "activate", "finish", "reset", "start" };
+    trace_ring_t &trace = _trace();
+    char num[12];
+
+    trace.paused = true;
+    unsigned long seq = trace.seq > DS_MQTT_TRACE_SIZE ? trace.seq - DS_MQTT_TRACE_SIZE : 0;
+    for (; seq != trace.seq; ++seq) {
+      const trace_t &entry = trace.entries[seq % DS_MQTT_TRACE_SIZE];
+      _msgStart();
+      _msgAdd(entry.dir == TRACE_IN ? "\",\"trace\":\"in\"" : "\",\"trace\":\"out\"");
+      _msgAdd(",\"ms\":");
+      _msgAdd(ultoa(entry.ms, num, 10));
+      _msgAdd(",\"topic\":\"");
+      _msgAdd(ultoa(entry.topic, num, 16));
+      _msgAdd("\",\"prop\":");
+      _msgAdd(itoa(entry.prop, num, 10));
+      _msgAdd(",\"verb\":\"");
+      _msgAdd(verbs[entry.verb]);
+      _msgAdd("\",\"len\":");
+      _msgAdd(utoa(entry.length, num, 10));
+      _msgAdd(",\"us\":");
+      _msgAdd(utoa(entry.us, num, 10));
+      _msgAdd(entry.dup ? ",\"dup\":true}" : "}");
+      DS_MQTT_LOG_I(_console->println(_buf.msg));
+      this->publish("/er/diag/info", _buf.msg);
+    }
+    trace.paused = false;
+  }
+#endif
+
+#if DS_MQTT_BENCH
+  enum bench_cases {
+    BENCH_ROUTE_MISS, BENCH_ROUTE_HIT, BENCH_RENDER, BENCH_INFO_TICK, BENCH_SUBS_BUILD,
+    BENCH_CASES_NUM
+  };
+
+/*!
+* @brief prepares a bench case's input, not timed
+*/
+  static void _benchSetup(uint8_t bench)
+  {
+    if (bench == BENCH_ROUTE_HIT) {  /// < the last prop's topic, in _buf.msg
+      _buf.msg[0] = 0;
+      if (props_count > 0 && _propTopic(props_count - 1))
+        strcpy(_buf.msg, _buf.topic);
+    }
+  }
+
+/*!
+* @brief runs a bench case once
+* @return something depending on the work not to let it be optimized out
+*/
+  static int _benchRun(uint8_t bench)
+  {
+    int sink = 0;
+    switch (bench) {
+    case BENCH_ROUTE_MISS:  /// < worst case: every prop's id is compared
+      return _propIndex("/er/_no_such_prop_/cmd");
+    case BENCH_ROUTE_HIT:   /// < the last prop, see _benchSetup
+      return _propIndex(_buf.msg);
+    case BENCH_RENDER:
+      _msgInfo(_buf.msg, BUF_SIZE, "bench_prop", MQTT_STRSTATUS_ENABLED, 1);
+      return _buf.msg[0];
+    case BENCH_INFO_TICK:   /// < _sendInfoLoop's rendering without publishing
+      for (size_t i = 0; i < props_count; ++i) {
+        if (!_isShown(i))
+          continue;
+        _msgInfo(_buf.msg, BUF_SIZE, props_STRIDS[i], MQTT_STRSTATUS_ENABLED, mqtt_numbers[i]);
+        sink += _buf.msg[0];
+      }
+      return sink;
+    case BENCH_SUBS_BUILD:  /// < _onConnected's topics without subscribing
+      for (size_t i = 0; i < props_count; ++i)
+        sink += _propTopic(i) != nullptr;
+      return sink;
+    }
+    return sink;
+  }
+
+/*!
+* @brief benchmarks the hot paths
+* @detail {"id":"<CLIENT_NAME>","bench":"<case>","props":<props_count>,
+*          "n":<iterations>,"ns":<per op>,"alloc":<heap growth, B>};
+*         the sampler is paused meanwhile;
+*         the names and the format are stable to compare builds,
+*         micros() resolution is 4 us on 16 MHz boards;
+*         with DS_MQTT_CYCLES "ns" is replaced with exact "cyc" per op
+*/
+  void _bench()
+  {
+    static const char *const names[BENCH_CASES_NUM] = {
+      "route_miss", "route_hit", "render", "info_tick", "subs_build"
+    };
+    volatile int sink = 0;
+    char num[12];
+
+#if DS_MQTT_SAMPLER
+    ds_MQTT::sampler_stop();  /// < its ISR would be timed with the cases
+#endif
+    for (uint8_t bench = 0; bench < BENCH_CASES_NUM; ++bench) {
+      _benchSetup(bench);
+      const char *heap = ds_MQTT::heap_top();
+      unsigned long start = ds_MQTT::ticks();
+      for (uint16_t n = 0; n < DS_MQTT_BENCH_ITERATIONS; ++n)
+        sink = sink + _benchRun(bench);
+      unsigned long spent = ds_MQTT::ticks() - start;
+
+      _msgStart();
+      _msgAdd("\",\"bench\":\"");
+      _msgAdd(names[bench]);
+      _msgAdd("\",\"props\":");
+      _msgAdd(ultoa(props_count, num, 10));
+      _msgAdd(",\"n\":");
+      _msgAdd(ultoa(DS_MQTT_BENCH_ITERATIONS, num, 10));
+#if DS_MQTT_CYCLES
+      _msgAdd(",\"cyc\":");
+      _msgAdd(ultoa(spent / DS_MQTT_BENCH_ITERATIONS, num, 10));
+#else
+      _msgAdd(",\"ns\":");
+      _msgAdd(ultoa(spent * 1000UL / DS_MQTT_BENCH_ITERATIONS, num, 10));
+#endif
+      _msgAdd(",\"alloc\":");
+      _msgAdd(itoa(ds_MQTT::heap_top() - heap, num, 10));
+      _msgAdd("}");
+
+      DS_MQTT_LOG_I(_console->println(_buf.msg));
+      this->publish("/er/diag/info", _buf.msg);
+    }
+#if DS_MQTT_SAMPLER
+    ds_MQTT::sampler_start();
+#endif
+  }
+#endif
+
+#if DS_MQTT_SAMPLER
+  static constexpr uint8_t SAMPLES_PER_MSG = 8U;
+
+/*!
+* @brief dumps the non-empty buckets to /er/diag/info and the console
+* @detail {"id":"<CLIENT_NAME>","lo":<LO>,"shift":<SHIFT>,"out":<outside>,
+*          "b":[[<bucket>,<count>],...]} of up to SAMPLES_PER_MSG buckets,
+*         console lines are "sample <bucket> <count>"
+*/
+  void _sendSamples()
+  {
+    char num[12];
+    uint8_t i = 0;
+
+    do {
+      _msgStart();
+      _msgAdd("\",\"lo\":");
+      _msgAdd(ultoa(DS_MQTT_SAMPLER_LO, num, 10));
+      _msgAdd(",\"shift\":");
+      _msgAdd(utoa(DS_MQTT_SAMPLER_SHIFT, num, 10));
+      _msgAdd(",\"out\":");
+      _msgAdd(utoa(ds_MQTT::sampler_count(DS_MQTT_SAMPLER_BUCKETS), num, 10));
+      _msgAdd(",\"b\":[");
+
+      for (uint8_t n = 0; i < DS_MQTT_SAMPLER_BUCKETS && n < SAMPLES_PER_MSG; ++i) {
+        uint16_t count = ds_MQTT::sampler_count(i);
+        if (count == 0)
+          continue;
+
+        if (n++)
+          _msgAdd(",");
+        _msgAdd("[");
+        _msgAdd(utoa(i, num, 10));
+        _msgAdd(",");
+        _msgAdd(utoa(count, num, 10));
+        _msgAdd("]");
+
+        DS_MQTT_LOG_I(_console->print(F("sample ")));
+        DS_MQTT_LOG_I(_console->print(utoa(i, num, 10)));
+        DS_MQTT_LOG_I(_console->print(F(" ")));
+        DS_MQTT_LOG_I(_console->println(utoa(count, num, 10)));
+      }
+
+      _msgAdd("]}");
+      this->publish("/er/diag/info", _buf.msg);
+    } while (i < DS_MQTT_SAMPLER_BUCKETS);
+  }
+#endif
+
+  enum prof_sections {
+    PROF_HW, PROF_NET, PROF_DISPATCH, PROF_CONNECT, PROF_INFO, PROF_HEALTH,
+    PROF_SECTIONS_NUM
+  };
 
 /*!
-* @file contains class MQTT_manager, types and values
-*       to operate props using MQTT protocol
+* @brief guard accounting its lifetime to a routine() section
+* @detail time of nested sections (dispatch inside _client.loop)
+*         is excluded from the enclosing one; compiles to nothing
+*         unless DS_MQTT_PROFILE
 */
-constexpr char MQTT_STRSTATUS_READY[]    = "Not activated"; // "Ready"?
-constexpr char MQTT_STRSTATUS_ENABLED[]  = "Activated";
-constexpr char MQTT_STRSTATUS_FINISHED[] = "Finished";
+  class prof_scope_t {
+  public:
+#if DS_MQTT_PROFILE
+    explicit prof_scope_t(uint8_t section):
+      _section(section),
+      _accounted(_profile().accounted),
+      _start(ds_MQTT::ticks())
+    {}
 
-constexpr size_t PROP_STATUS_MAX_SIZE       = 16U;
-constexpr size_t PROP_CB_TYPES_NUM          = 3U; // onActivate, onFinish, onReset
+    ~prof_scope_t()
+    {
+      profile_t &prof = _profile();
+      unsigned long spent = ds_MQTT::ticks() - _start - (prof.accounted - _accounted);
+      prof.sum[_section] += spent;
+      ++prof.count[_section];
+      if (spent > prof.max[_section])
+        prof.max[_section] = spent;
+      prof.accounted += spent;
 
-enum prop_cb_types { MQTT_CB_ACTIVATE, MQTT_CB_FINISH, MQTT_CB_RESET };
-typedef void(*prop_CBs_t[PROP_CB_TYPES_NUM])(void);
-typedef prop_CBs_t* props_CBs_t;
-typedef char prop_state_t[PROP_STATUS_MAX_SIZE];
-typedef char *const props_states_t;
+      if (_section == PROF_DISPATCH) {
+        uint8_t bucket = _histBucket(spent);
+        if (prof.dispatchHist[bucket] != 0xFFFF)
+          ++prof.dispatchHist[bucket];
+      }
+    }
 
-struct ds_MQTT {
-  static void reset()
+  private:
+    uint8_t       _section;
+    unsigned long _accounted;
+    unsigned long _start;
+#else
+    explicit prof_scope_t(uint8_t) {}
+#endif
+  };
+
+#if DS_MQTT_PROFILE
+  static constexpr uint8_t PROF_HIST_SUB = 4U;       /// < buckets per octave
+  static constexpr uint8_t PROF_HIST_OCTAVES = 24U;  /// < up to 2^24 ticks
+  static constexpr uint8_t PROF_HIST_BUCKETS = (PROF_HIST_OCTAVES - 1) * PROF_HIST_SUB;
+
+/*!
+* @brief histogram bucket of a dispatch time
+* @detail below 4 ticks a bucket per tick, then every octave [2^m, 2^(m+1))
+*         split into PROF_HIST_SUB equal parts, so a bucket spans at most
+*         a quarter of its lower bound; longer times go to the last bucket
+* @param [in] ticks dispatch time
+* @return bucket index
+*/
+  static uint8_t _histBucket(unsigned long ticks)
   {
-    wdt_enable(WDTO_60MS);
-    delay(1000);
+    if (ticks < PROF_HIST_SUB)
+      return ticks;
+    uint8_t msb = 0;
+    for (unsigned long t = ticks; t >>= 1; )
+      ++msb;
+    if (msb >= PROF_HIST_OCTAVES)
+      return PROF_HIST_BUCKETS - 1;
+    return (msb - 1) * PROF_HIST_SUB + ((ticks >> (msb - 2)) & (PROF_HIST_SUB - 1));
   }
-  static constexpr int8_t NOT_SHOW = -1;
-  typedef void (*mqtt_msg_handler_t)(char*, uint8_t*, unsigned int);
-};
 
 /*!
-* @class MQTT_manager 
-* @brief Facade class to use mqtt protocol via ethernet
-* @param [in] size_t props_count number of props operating on the circuit
-* @param [in] CLIENT_NAME unique id of the circuit
-* @param [in] props_STRIDS array of props' names
-* @param [in] er_onStart procedure called on ERP Start Game cmd
-* @param [in] er_onReset procedure called on ERP Reset All cmd
-* @param [in] props_CBs array of each prop callbacks (onActivate, OnFinish, onReset)
-* @param [in] special_CB pointer to a procedure to process a mqtt_msg in a custom way
-* @warning props_CBs has to contatin props_count arrays
-           of each prop's callbacks (3 CBs for each prop)
-* @todo reorder data fields for memory align
-* @example
-*            Console *consOLE = new Console();
-*
-*            constexpr size_t PROPS_NUM = 3;
-*            constexpr char strID[] = "box_yammychoco_mokka_EK$$$";
-*
-*            const char rname1[] = "box"; //> will be shown in ERP as "Box"
-*            const char rname2[] = "yammy_choco"; //> will be shown in ERP as "Yammy choco"
-*            const char rname3[] = "_mokka"; // not to be shown in the ERP because of prefix '_'
-*            const char *propsNames[PROPS_NUM] = {rname1, rname2, rname3};
-*            constexpr int riddles_num_in_ERP[PROPS_NUM] = {2,5,8};
-*
-*            void onSrt() {} void onRst() {}
-*            void r1a() {} void r1f() {} void r1r() {}
-*            void r2a() {} void r2f() {} void r2r() {}
-*            void r3a() {} void r3f() {} void r3r() {}
-*            void my_special_cb(char* topic, uint8_t* payload, unsigned int len)
-*            { if (strcmp(topic, "/er/music/cmd")) do_something(); }
-*
-*            prop_CBs_t prop1 = { r1a, r1f, r1r };
-*            prop_CBs_t prop2 = { r2a, r2f, r2r };
-*            prop_CBs_t prop3 = { r3a, r3f, r3r };
-*            props_CBs_t props_cbs[PROPS_NUM] = { &prop1, &prop2, &prop3};
-*
-*
-*            prop_state_t boxState   = {0};
-*            prop_state_t chocoState = {0};
-*            prop_state_t mokkaState = {0};
-*            props_states_t props_states[PROPS_NUM] = {boxState, chocoState, mokkaState};
-*
-*            ...
-*            auto *manag = new MQTT_manager< PROPS_NUM, strID, propsNames, riddles_num_in_ERP,
-*                                            onSrt, onRst, props_cbs>(consOLE);
-*            ...
-*            manag->check();
-*            ...
-*            manag->publish("hi", "there");
-*            ...
-*            manag->sendInfoLoop(props_states);
-*            ...
+* @param [in] bucket histogram bucket
+* @return exclusive upper bound of the bucket's ticks
 */
-template<size_t props_count,
-         const char* CLIENT_NAME,     /// client_name is for PROP_NAME
-         const char** props_STRIDS,   /// for STRIDs
-         const int* mqtt_numbers,     /// for props' numbers in ERP
-         void (*er_onStart)(),
-         void (*er_onReset)(),
-         props_CBs_t *props_CBs,
-         void (*special_CB)(char*, uint8_t*, unsigned int) = nullptr,
-         const char** extra_topics = nullptr,
-         const size_t extra_topics_count = 0>
-class MQTT_manager
-{
-public:
+  static unsigned long _histUpper(uint8_t bucket)
+  {
+    if (bucket < PROF_HIST_SUB)
+      return bucket + 1UL;
+    uint8_t shift = bucket / PROF_HIST_SUB - 1;
+    return (PROF_HIST_SUB + 1UL + bucket % PROF_HIST_SUB) << shift;
+  }
+
 /*!
-* @brief MQTT_manager constructor
-* @detail setup a client, server, callback for received msgs
-* @param [in] console pointer to out stream Strategy object
-* @param [in] ip_ending necessary for Ethernet static object (Singleton)
-* @param [in] mqqt_port server port for PubSubClient (this class' field)
-* @todo shrink it
-* @todo replace the hardcode
+* @detail dispatchHist[k] counts dispatches taking [_histUpper(k - 1),
+*         _histUpper(k)) ticks, see _histBucket
 */
-  explicit MQTT_manager(const Console *console,
-                        const byte ip_ending,
-                        const size_t &mqtt_port = 1883):
-    _console(console),
-    _server(192, 168, 10, 1),
-    _lastReconnectAttempt(0),
-    _ip_ending(ip_ending)
+  struct profile_t {
+    uint64_t      sum[PROF_SECTIONS_NUM];
+    unsigned long max[PROF_SECTIONS_NUM];
+    unsigned long count[PROF_SECTIONS_NUM];
+    unsigned long accounted;
+    unsigned long since;  /// < ms
+    uint16_t      dispatchHist[PROF_HIST_BUCKETS];
+  };
+
+  static profile_t& _profile()
   {
-    _console->println(F("Initializing Ethernet..."));
-    _startEthernet();
-    _console->print(F("Local IP: "));
-    _console->println(Ethernet.localIP());
-    _console->println(F("Ethernet Initialized..."));
-    _client.setClient(_ethernetClient);
-    _client.setServer(_server, mqtt_port);
-    _client.setCallback(default_msg_handler);
-    delay(1500);
+    static profile_t prof;
+    return prof;
+  }
+
+  static void _profileReset()
+  {
+    memset(&_profile(), 0, sizeof(profile_t));
+    _profile().since = millis();
   }
 
 /*!
-* @brief a procedure to be called in loop
-* @param props_states props' current states
-* @warning props_states' elements' number must be equal to props_count
-* @detail calls methods: _check and _sendInfoLoop
+* @brief publishes a msg per section to /er/diag/info and the console
+* @detail {"id":"<CLIENT_NAME>","sec":"<name>","pct":<share of the time
+*         since reset>,"n":<runs>,"avg":<ticks>,"max":<worst run, ticks>,
+*         "unit":"us"|"cyc"}; ticks are us or, with DS_MQTT_CYCLES, cycles;
+*         followed by {"id":"<CLIENT_NAME>","sec":"dispatch_pct","p50":<ticks>,
+*         "p90":<ticks>,"p99":<ticks>,"unit":..} upper bounds of histogram buckets
+*         a quarter octave wide (within 25 % above the exact percentile)
 */
-  void routine(const char *const *props_states)
+  void _sendProfile()
   {
-    _check();
-    _sendInfoLoop(props_states);
+    static const char *const names[PROF_SECTIONS_NUM] = {
+      "hw", "net", "dispatch", "connect", "info", "health"
+    };
+    const profile_t &prof = _profile();
+    uint64_t total = static_cast<uint64_t>(millis() - prof.since + 1) * ds_MQTT::TICKS_PER_MS;
+    char num[12];
+
+    for (uint8_t i = 0; i < PROF_SECTIONS_NUM; ++i) {
+      unsigned long pm = prof.sum[i] * 1000 / total;
+      unsigned long avg = prof.count[i] ? prof.sum[i] / prof.count[i] : 0;
+      _msgStart();
+      _msgAdd("\",\"sec\":\"");
+      _msgAdd(names[i]);
+      _msgAdd("\",\"pct\":");
+      _msgAdd(ultoa(pm / 10, num, 10));
+      _msgAdd(".");
+      _msgAdd(ultoa(pm % 10, num, 10));
+      _msgAdd(",\"n\":");
+      _msgAdd(ultoa(prof.count[i], num, 10));
+      _msgAdd(",\"avg\":");
+      _msgAdd(ultoa(avg, num, 10));
+      _msgAdd(",\"max\":");
+      _msgAdd(ultoa(prof.max[i], num, 10));
+      _msgAdd(DS_MQTT_CYCLES ? ",\"unit\":\"cyc\"}" : ",\"unit\":\"us\"}");
+      DS_MQTT_LOG_I(_console->println(_buf.msg));
+      this->publish("/er/diag/info", _buf.msg);
+    }
+
+    _msgStart();
+    _msgAdd("\",\"sec\":\"dispatch_pct\"");
+    _msgAdd(",\"p50\":");
+    _msgAdd(ultoa(_dispatchPercentile(50), num, 10));
+    _msgAdd(",\"p90\":");
+    _msgAdd(ultoa(_dispatchPercentile(90), num, 10));
+    _msgAdd(",\"p99\":");
+    _msgAdd(ultoa(_dispatchPercentile(99), num, 10));
+    _msgAdd(DS_MQTT_CYCLES ? ",\"unit\":\"cyc\"}" : ",\"unit\":\"us\"}");
+    DS_MQTT_LOG_I(_console->println(_buf.msg));
+    this->publish("/er/diag/info", _buf.msg);
   }
 
 /*!
-* @brief decorator providing access to mqtt publish interface
-* @param [in] topic kind of address
-* @param [in] payload the msg itself
-* @param [in] retained if true the value is supposed to be kept on mqtt server
-* @return bool true if published and false otherwise
+* @param [in] pct percentile
+* @return upper bound of the histogram bucket holding the percentile
 */
-  bool publish(const char* topic, const char* payload, bool retained = false)
+  static unsigned long _dispatchPercentile(uint8_t pct)
   {
-    return _client.publish(topic, payload, retained);
+    const profile_t &prof = _profile();
+    unsigned long total = 0;
+    for (uint8_t k = 0; k < PROF_HIST_BUCKETS; ++k)
+      total += prof.dispatchHist[k];
+
+    unsigned long seen = 0;
+    for (uint8_t k = 0; k < PROF_HIST_BUCKETS; ++k) {
+      seen += prof.dispatchHist[k];
+      if (total && seen * 100 >= total * pct)
+        return _histUpper(k);
+    }
+    return 0;
   }
+#endif
 
-  bool is_connected()
+/*!
+* @brief error events since boot: the module or the link lost, failed connects
+*/
+  static unsigned long& _errors()
   {
-    return _client.connected();
+    static unsigned long errors = 0;
+    return errors;
   }
 
-  MQTT_manager(const MQTT_manager&)             = delete;
-  MQTT_manager(MQTT_manager&&)                  = delete;
-  MQTT_manager& operator=(const MQTT_manager&)  = delete;
-  MQTT_manager& operator=(MQTT_manager&&)       = delete;
-
-private:
-  static constexpr size_t BUF_SIZE                   = 128U;
-  static constexpr size_t ON_CONNECTED_BUF_MAX_SIZE  = 32U;
-  static void default_msg_handler(char* topic, uint8_t* payload, unsigned int length);
 /*!
 * @brief makes hardware checks
 * @return zero on success otherwise error code
@@ -176,28 +2411,48 @@ private:
   int _hardware_status()
   {
     static bool last_status = true;
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_ERROR
     static unsigned long last_time_stamp = millis();
+#endif
         
-    if (Ethernet.hardwareStatus() == EthernetNoHardware) {
+    if (!transport::hardware_ok()) {
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_ERROR
       if (millis() - last_time_stamp > 1000) {
         _console->println(F("ethernet module missing"));
         last_time_stamp = millis();
       }
+#endif
+      if (last_status) {
+        ++_errors();
+#if DS_MQTT_RECORDER
+        ds_MQTT::record(ds_MQTT::REC_NO_HARDWARE);
+#endif
+      }
       last_status = false;
       return -1;
     }
 
-    if (Ethernet.linkStatus() == LinkOFF) {
+    if (!transport::link_ok()) {
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_ERROR
       if (millis() - last_time_stamp > 1000) {
         _console->println(F("LAN cable missing"));
         last_time_stamp = millis();
       }
+#endif
+      if (last_status) {
+        ++_errors();
+#if DS_MQTT_RECORDER
+        ds_MQTT::record(ds_MQTT::REC_NO_LINK);
+#endif
+      }
       last_status = false;
       return -1;
     }
 
+#if DS_MQTT_LOG_LEVEL >= DS_MQTT_LOG_INFO
     if (last_status == false)
       _console->println(F("ethernet hardware is restored"));
+#endif
     
     last_status = true;
     return 0;
@@ -209,24 +2464,54 @@ private:
 */
   void _check()
   {
-    if (_hardware_status())
-      return;
+    {
+      prof_scope_t scope(PROF_HW);
+      if (_hardware_status())
+        return;
+    }
       
+#if DS_MQTT_RECORDER
+    static bool wasConnected = false;
+#endif
     if ( _client.connected() ) {
+      prof_scope_t scope(PROF_NET);
+#if DS_MQTT_RECORDER
+      wasConnected = true;
+#endif
       _client.loop();           /// does mqtt routine
       return;
     }
+#if DS_MQTT_RECORDER
+    if (wasConnected)
+      ds_MQTT::record(ds_MQTT::REC_DISCONNECT);
+    wasConnected = false;
+#endif
 
     unsigned long now = millis();             /// every 5 seconds
     if (now - _lastReconnectAttempt > 5000) {
+      prof_scope_t scope(PROF_CONNECT);
       _lastReconnectAttempt = now;
       if (this->_reconnect())                /// tries to reconnect
         _lastReconnectAttempt = 0;
     }
   }
 
+  enum json_escapes { ESCAPE_ID = 1, ESCAPE_STATUS = 2 };
+
+/*!
+* @brief the MQTT_STRSTATUS_* constants need no escaping, other states
+*        are escaped in the same pass that copies them
+*/
+  static uint8_t _statusEscape(const char *state)
+  {
+    if (state == MQTT_STRSTATUS_READY || state == MQTT_STRSTATUS_ENABLED ||
+        state == MQTT_STRSTATUS_FINISHED)
+      return 0;
+    return ESCAPE_STATUS;
+  }
+
 /*!
-* @brief publishes info about props' props states every second,
+* @brief publishes info about props' props states every _infoPeriod() ms,
 *        also, kind of a heartbeat system
 * @param props_states props' current states
 * @warning props_states' elements' number must be equal to props_count
@@ -236,27 +2521,320 @@ private:
 */
   void _sendInfoLoop(const char *const *props_states)
   {
+    prof_scope_t scope(PROF_INFO);
     static unsigned long lastTS = 0;
-    if (millis() - lastTS <= 1000)
+    if (millis() - lastTS <= _infoPeriod())
       return;    
+#if DS_MQTT_INFO_ADAPTIVE
+    _heartbeatAdapt();
+#endif
+#if DS_MQTT_OWN_STATES
+    const bool own = props_states == _statesPtrs;  /// < _applyState set their escapes
+#else
+    const bool own = false;
+#endif
 
     for (size_t i = 0; i < props_count; ++i) {
-      char msgBuf[BUF_SIZE] = {0};
-      
-      if (props_STRIDS[i] == nullptr) /// < means no need to public in ERP
-        continue;
-
-      if (props_STRIDS[i][0] == '_' || mqtt_numbers[i] < 0) /// < todo: delete '_'
+      if (!_isShown(i))
         continue;
 
-      _msgInfo(msgBuf, // input param
+      _msgInfo(_buf.msg, BUF_SIZE, // input param
                props_STRIDS[i],
                props_states[i],
-               mqtt_numbers[i]);
+               mqtt_numbers[i],
+               own ? _escapes[i] : _escapes[i] | _statusEscape(props_states[i]));
+
+      _publishInfo();
+    }
+
+    lastTS = millis();
+  }
+
+/*!
+* @brief publishes _buf.msg to /er/riddles/info, with
+*        DS_MQTT_INFO_ADAPTIVE noting how it went
+*/
+  bool _publishInfo()
+  {
+#if DS_MQTT_INFO_ADAPTIVE
+    unsigned long start = millis();
+    bool ok = this->publish("/er/riddles/info", _buf.msg);
+    heartbeat_t &hb = _heartbeat();
+    hb.failed |= !ok && _client.connected();  /// < an outage is not the broker's load
+    hb.spent += millis() - start;
+    return ok;
+#else
+    return this->publish("/er/riddles/info", _buf.msg);
+#endif
+  }
+
+#if DS_MQTT_INFO_ADAPTIVE
+/*!
+* @brief the adaptive heartbeat's state, see DS_MQTT_INFO_ADAPTIVE
+*/
+  struct heartbeat_t {
+    unsigned long period;      /// < ms
+    unsigned long boostUntil;  /// < millis()
+    unsigned long spent;       /// < ms publishing in the current period
+    unsigned long rtt;         /// < ms, PUBACKs' moving average
+    bool          failed;      /// < a publish of the current period
+    bool          acked;       /// < a PUBACK's round trip in the current period
+  };
+
+  static heartbeat_t& _heartbeat()
+  {
+    static heartbeat_t hb = { DS_MQTT_INFO_REFRESH, 0, 0, 0, false, false };
+    return hb;
+  }
+
+/*!
+* @brief shortens the period for a while: something changed
+*/
+  static void _heartbeatBoost()
+  {
+    _heartbeat().boostUntil = millis() + DS_MQTT_INFO_BOOST;
+  }
+
+/*!
+* @brief sets the period by how the last one went, at its end
+* @detail rtt halves after a period without PUBACKs, so an old slow
+*         round trip does not hold the period at DS_MQTT_INFO_MAX
+*/
+  static void _heartbeatAdapt()
+  {
+    heartbeat_t &hb = _heartbeat();
+    if (hb.failed || hb.spent > DS_MQTT_INFO_LAG || hb.rtt > DS_MQTT_INFO_LAG)
+      hb.period = hb.period * 2 > DS_MQTT_INFO_MAX ? DS_MQTT_INFO_MAX : hb.period * 2;
+    else
+      hb.period = DS_MQTT_INFO_REFRESH + (hb.period - DS_MQTT_INFO_REFRESH) / 2;
+    if (!hb.acked)
+      hb.rtt /= 2;
+    hb.failed = false;
+    hb.acked = false;
+    hb.spent = 0;
+  }
+#endif
+
+/*!
+* @brief the info period, ms
+*/
+  static unsigned long _infoPeriod()
+  {
+#if DS_MQTT_INFO_ADAPTIVE
+    const heartbeat_t &hb = _heartbeat();
+    if (hb.period == DS_MQTT_INFO_REFRESH && static_cast<long>(hb.boostUntil - millis()) > 0)
+      return DS_MQTT_INFO_FAST < DS_MQTT_INFO_REFRESH ? DS_MQTT_INFO_FAST : DS_MQTT_INFO_REFRESH;
+    return hb.period;
+#else
+    return DS_MQTT_INFO_REFRESH;
+#endif
+  }
+
+#if DS_MQTT_OWN_STATES
+/*!
+* @brief stores prop i's state, with DS_MQTT_DIRTY marks it if changed
+*/
+  void _applyState(size_t i, const char *state)
+  {
+    if (strncmp(_states[i], state, PROP_STATUS_MAX_SIZE - 1) == 0)
+      return;
+    strncpy(_states[i], state, PROP_STATUS_MAX_SIZE - 1);
+    _states[i][PROP_STATUS_MAX_SIZE - 1] = 0;
+    if (ds_MQTT::json_safe(_states[i]))
+      _escapes[i] &= ~ESCAPE_STATUS;
+    else
+      _escapes[i] |= ESCAPE_STATUS;
+#if DS_MQTT_RECORDER
+    ds_MQTT::record(ds_MQTT::REC_STATE, i);
+#endif
+#if DS_MQTT_INFO_ADAPTIVE
+    _heartbeatBoost();
+#endif
+#if DS_MQTT_DIRTY
+    _dirty[i / DIRTY_WORD_BITS] |= _shown[i / DIRTY_WORD_BITS] & (1UL << (i % DIRTY_WORD_BITS));
+#endif
+#if DS_MQTT_DIRTY && DS_MQTT_QOS1
+    _changed[i / DIRTY_WORD_BITS] |= _shown[i / DIRTY_WORD_BITS] & (1UL << (i % DIRTY_WORD_BITS));
+#endif
+  }
+#endif
 
-      this->publish("/er/riddles/info", msgBuf);
+#if DS_MQTT_DIRTY
+  static constexpr size_t DIRTY_WORD_BITS = sizeof(unsigned long) * 8;
+  static constexpr size_t DIRTY_WORDS     = (props_count + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS;
+
+/*!
+* @brief _sendInfoLoop for DS_MQTT_DIRTY: publishes the marked props only
+* @detail clean words are skipped whole and the marked bits of a word
+*         are taken lowest first, so a tick costs the changes plus
+*         props_count / DIRTY_WORD_BITS word reads; the scan resumes after
+*         the last prop sent, round-robin, so when DS_MQTT_INFO_BURST cuts
+*         a tick the high props are not starved; while disconnected
+*         the marks are kept; with DS_MQTT_QOS1 the changes (_changed)
+*         wait for a free slot of the window, marked, while the scan goes
+*         on with the rest
+*/
+  void _sendChangedLoop()
+  {
+    prof_scope_t scope(PROF_INFO);
+    static unsigned long lastTS = 0;
+    static size_t next = 0;           /// < the prop the scan resumes at
+    if (millis() - lastTS > _infoPeriod()) {
+#if DS_MQTT_INFO_ADAPTIVE
+      _heartbeatAdapt();
+#endif
+      memcpy(_dirty, _shown, sizeof(_dirty));
+      lastTS = millis();
+    }
+
+    if (!_client.connected())
+      return;
+
+    uint8_t sent = 0;
+    const size_t start = next;
+    const size_t shift = start % DIRTY_WORD_BITS;
+    /// the words from next's one on, wrapping round to its bits below next
+    for (size_t k = 0; k <= DIRTY_WORDS; ++k) {
+      size_t w = (start / DIRTY_WORD_BITS + k) % DIRTY_WORDS;
+      unsigned long pending = _dirty[w];
+      if (k == 0)
+        pending &= ~0UL << shift;
+      else if (k == DIRTY_WORDS)
+        pending &= shift ? ~(~0UL << shift) : 0UL;
+      while (pending) {
+        if (sent == DS_MQTT_INFO_BURST)
+          return;
+        size_t i = w * DIRTY_WORD_BITS + __builtin_ctzl(pending);
+        unsigned long bit = pending & (~pending + 1);  /// < the lowest one
+        pending &= ~bit;
+
+#if DS_MQTT_QOS1
+        if ((_changed[w] & bit) && !_qos1Slot())
+          continue;                   /// < the window is full, kept marked for later
+#endif
+        _msgInfo(_buf.msg, BUF_SIZE, props_STRIDS[i], _states[i], mqtt_numbers[i], _escapes[i]);
+#if DS_MQTT_QOS1
+        if (_changed[w] & bit) {
+          if (!publish_qos1("/er/riddles/info", _buf.msg))
+            continue;
+          _changed[w] &= ~bit;
+        } else
+#endif
+        _publishInfo();
+        _dirty[w] &= ~bit;
+        next = (i + 1) % props_count;
+        ++sent;
+      }
+    }
+  }
+#endif
+
+/*!
+* @brief accumulates loop period and free SRAM statistics
+* @detail called once per routine(), the values are reported
+*         and dropped by _sendHealthLoop
+*/
+  void _loopStats()
+  {
+    unsigned long now = micros();
+    if (_loopLastUs != 0) {
+      unsigned long period = now - _loopLastUs;
+      _loopSumUs += period;
+      ++_loopCount;
+      if (period > _loopMaxUs)
+        _loopMaxUs = period;
+#if DS_MQTT_RECORDER
+      /// failed connects block for seconds, they are recorded on their own
+      if (period > DS_MQTT_RECORDER_SLOW * 1000UL && _client.connected())
+        ds_MQTT::record(ds_MQTT::REC_SLOW, period / 1000UL > 0xFFFF ? 0xFFFF : period / 1000UL);
+#endif
+    }
+    _loopLastUs = now;
+
+#ifdef __AVR__
+    int ram = ds_MQTT::free_ram();
+    if (ram < _minFreeRam)
+      _minFreeRam = ram;
+#endif
+  }
+
+/*!
+* @brief publishes the controller's health every DS_MQTT_HEALTH_PERIOD ms
+* @detail {"id":"<CLIENT_NAME>","up":<s>,"ram":<B>,"ramMin":<B>,
+*          "loopAvg":<us>,"loopMax":<us>,"reset":"<cause>"};
+*         ramMin is the lowest free SRAM seen in routine() since boot,
+*         both are left out off AVR where free SRAM is not tracked,
+*         with DS_MQTT_STACK_PAINT it is the painted one and "stack":<B>
+*         (the stack high-water mark) is appended, then "err":<n> (see
+*         _errors), with DS_MQTT_DEDUP "dup":<n> (duplicates dropped),
+*         with DS_MQTT_INFO_ADAPTIVE "hb":<ms> (the info period),
+*         with DS_MQTT_QOS1 "resent":<n> (QoS 1 retransmissions) and
+*         with DS_MQTT_THREADED "qDrop":<n> (commands dropped on a full queue)
+*/
+  void _sendHealthLoop()
+  {
+    prof_scope_t scope(PROF_HEALTH);
+    static unsigned long lastTS = 0;
+    if (DS_MQTT_HEALTH_PERIOD == 0 || millis() - lastTS <= DS_MQTT_HEALTH_PERIOD)
+      return;
+
+    char num[12];
+
+    _msgStart();
+    _msgAdd("\",\"up\":");
+    _msgAdd(ultoa(millis() / 1000, num, 10));
+#ifdef __AVR__                        /// < free_ram() is 0 elsewhere
+    _msgAdd(",\"ram\":");
+    _msgAdd(itoa(ds_MQTT::free_ram(), num, 10));
+    _msgAdd(",\"ramMin\":");
+#if DS_MQTT_STACK_PAINT
+    _msgAdd(itoa(ds_MQTT::stack_unused(), num, 10));
+#else
+    _msgAdd(itoa(_minFreeRam, num, 10));
+#endif
+#endif
+    _msgAdd(",\"loopAvg\":");
+    _msgAdd(ultoa(_loopCount ? _loopSumUs / _loopCount : 0, num, 10));
+    _msgAdd(",\"loopMax\":");
+    _msgAdd(ultoa(_loopMaxUs, num, 10));
+    _msgAdd(",\"reset\":\"");
+    _msgAdd(ds_MQTT::reset_cause());
+#if DS_MQTT_STACK_PAINT
+    _msgAdd("\",\"stack\":");
+    _msgAdd(itoa(ds_MQTT::stack_max(), num, 10));
+#else
+    _msgAdd("\"");
+#endif
+    _msgAdd(",\"err\":");
+    _msgAdd(ultoa(_errors(), num, 10));
+#if DS_MQTT_DEDUP
+    _msgAdd(",\"dup\":");
+    _msgAdd(ultoa(_dedup().dropped, num, 10));
+#endif
+#if DS_MQTT_INFO_ADAPTIVE
+    _msgAdd(",\"hb\":");
+    _msgAdd(ultoa(_infoPeriod(), num, 10));
+#endif
+#if DS_MQTT_QOS1
+    _msgAdd(",\"resent\":");
+    _msgAdd(ultoa(_qos1().resent, num, 10));
+#endif
+#if DS_MQTT_THREADED
+    _msgAdd(",\"qDrop\":");
+    _msgAdd(ultoa(_queueDrops(), num, 10));
+#endif
+    _msgAdd("}");
+
+    if (_buf.msgCut) {                /// < cut JSON, a longer CLIENT_NAME
+      ++_errors();
+      DS_MQTT_LOG_E(_console->println(F("health msg does not fit BUF_SIZE")));
+    } else {
+      this->publish("/er/health", _buf.msg);
     }
 
+    _loopSumUs = 0;
+    _loopMaxUs = 0;
+    _loopCount = 0;
     lastTS = millis();
   }
 
@@ -266,16 +2844,32 @@ private:
 */
   bool _reconnect()
   {
-    _console->println(F("MQTT: Connecting ..."));
+    DS_MQTT_LOG_I(_console->println(F("MQTT: Connecting ...")));
 
-    if (_client.connect(CLIENT_NAME)) {
-      _console->print(F("MQTT: Connected (id: "));
-      _console->print(CLIENT_NAME);
-      _console->println(F(")"));
+#if DS_MQTT_PERSISTENT
+    bool connected = _client.connect(CLIENT_NAME, nullptr, nullptr, nullptr, 0, false, nullptr, false);
+#else
+    bool connected = _client.connect(CLIENT_NAME);
+#endif
+    if (connected) {
+      DS_MQTT_LOG_I(_console->print(F("MQTT: Connected (id: ")));
+      DS_MQTT_LOG_I(_console->print(CLIENT_NAME));
+      DS_MQTT_LOG_I(_console->println(F(")")));
       _onConnected();
+#if DS_MQTT_INFO_ADAPTIVE
+      _heartbeatBoost();
+#endif
+#if DS_MQTT_RECORDER
+      ds_MQTT::record(ds_MQTT::REC_CONNECT);
+      _sendRecords();
+#endif
     } else {
-      _console->print(F("MQTT: Failed, Return Code: "));
-      _console->println(_client.state());
+      ++_errors();
+#if DS_MQTT_RECORDER
+      ds_MQTT::record(ds_MQTT::REC_CONNECT_FAIL, _client.state());
+#endif
+      DS_MQTT_LOG_E(_console->print(F("MQTT: Failed, Return Code: ")));
+      DS_MQTT_LOG_E(_console->println(_client.state()));
       _onDisconnected();
     }
 
@@ -284,32 +2878,53 @@ private:
 
 /*!
 * @brief does a mqtt client connection routines
-* @detail subscribes to topics "/er/cmd" and the props' ones
+* @detail subscribes to topics "/er/cmd" and the props' ones,
+*         with DS_MQTT_PERSISTENT at QoS 1 and only if the broker
+*         has not kept them, i.e. every subscribe of an earlier connect
+*         went out
 */
   void _onConnected()
   {
+#if DS_MQTT_PERSISTENT
+    static bool subscribed = false;
+    if (subscribed && _netClient.session_present())
+      return;
+#endif
+    const uint8_t qos = DS_MQTT_PERSISTENT ? 1 : 0;
+    bool all = true;
+
     for (size_t i = 0; i < props_count; ++i) {
-      char buf[ON_CONNECTED_BUF_MAX_SIZE] = {"/er/"};
-      strcat(buf, props_STRIDS[i]);
-      strcat(buf, "/cmd");
-      _client.subscribe(buf);
+      const char *topic = _propTopic(i);
+      if (topic) {
+        all &= _client.subscribe(topic, qos);
+        continue;
+      }
+      ++_errors();
+      DS_MQTT_LOG_E(_console->print(F("prop id too long to subscribe: ")));
+      DS_MQTT_LOG_E(_console->println(props_STRIDS[i]));
     }
 
-    _client.subscribe("/er/cmd");
+    all &= _client.subscribe("/er/cmd", qos);
+
+    if (DS_MQTT_DIAG)
+      all &= _client.subscribe("/er/diag");
 
     for (size_t i = 0; i < extra_topics_count; ++i)
-      _client.subscribe(extra_topics[i]);
+      all &= _client.subscribe(extra_topics[i], qos);
+
+#if DS_MQTT_PERSISTENT
+    subscribed = all;
+#else
+    (void)all;
+#endif
   }
   
 /*!
-* @brief simply restarts the W5500 object
+* @brief simply restarts the network interface (the W5500 by default)
 */
   void _startEthernet()
   {
-    byte mac[] = {0x90, 0xA2, 0xDA, 0x10, 0xA9, _ip_ending};
-    IPAddress ip(192, 168, 10, _ip_ending);
-
-    Ethernet.begin(mac, ip);
+    transport::begin(_ip_ending);
   }
 
   /*!
@@ -325,63 +2940,95 @@ private:
 /*!
 * @brief "builds" a string according to the customized mqtt protocol
 * @param [out] msgData result of the procedure
+* @param [in] size msgData's capacity, the result is truncated to fit it
 * @param [in] strId prop id name
 * @param [in] strStatus prop's current state
 * @param [in] number prop's number in ERP
+* @param [in] escape json_escapes of the strings to be escaped,
+*                    the safe ones are copied as they are
 * @detail if strId[0] == '_' the riddle not to be shown in the ERP
 */
   static void _msgInfo(char *msgData,
+                size_t size,
                 const char* strId,
                 const char* strStatus,
-                const int &number)
+                const int &number,
+                uint8_t escape = 0)
   {
+    bool (*const appendId)(char*, size_t, const char*) =
+      escape & ESCAPE_ID ? ds_MQTT::append_json : ds_MQTT::append;
     //"{\"strId\":\"" MQTT_1_STRID "\", \"strName\":\"" MQTT_1_STRNAME "\", \"strStatus\":\"" + strStatus1 + "\", \"number\":\"" + MQTT_1_NUMBER + "\"}";
 	char *spacer_ptr;
 	size_t start, end;
 	msgData[0] = 0;
-	strcat(msgData, "{");
+	ds_MQTT::append(msgData, size, "{");
 
 	//  strId  //
-	strcat(msgData, "\"strId\":\"");
-	strcat(msgData, strId);
-	strcat(msgData, "\", ");
+	ds_MQTT::append(msgData, size, "\"strId\":\"");
+	appendId(msgData, size, strId);
+	ds_MQTT::append(msgData, size, "\", ");
 
 	//  strName  //
-	strcat(msgData, "\"strName\":\"");
-	end = start = strlen(msgData);
-	strcat(msgData, strId);
-	end += strlen(strId);
+	ds_MQTT::append(msgData, size, "\"strName\":\"");
+	start = strlen(msgData);
+	appendId(msgData, size, strId);
+	end = strlen(msgData);
 	spacer_ptr = msgData + start;
 	while (spacer_ptr < msgData + end) { // all '_'s into ' 's
 		if (*spacer_ptr == '_')
 			*spacer_ptr = ' ';
 		++spacer_ptr;
 	}
-	msgData[start] -= 32; // capitalizing the 1st letter
-	strcat(msgData, "\", ");
+	if (msgData[start] >= 'a' && msgData[start] <= 'z')
+		msgData[start] -= 32; // capitalizing the 1st letter
+	ds_MQTT::append(msgData, size, "\", ");
 
 	//  strStatus  //
-	strcat(msgData, "\"strStatus\":\"");
-	strcat(msgData, strStatus);
-	strcat(msgData, "\", ");
+	ds_MQTT::append(msgData, size, "\"strStatus\":\"");
+	if (escape & ESCAPE_STATUS)
+		ds_MQTT::append_json(msgData, size, strStatus);
+	else
+		ds_MQTT::append(msgData, size, strStatus);
+	ds_MQTT::append(msgData, size, "\", ");
 
 	//  number  //
-	strcat(msgData, "\"number\":\"");
-	char strVal2[8];
+	ds_MQTT::append(msgData, size, "\"number\":\"");
+	char strVal2[sizeof(int) * 3 + 2];  // "-32768" on AVR, "-2147483648" on hosts
 	itoa(number, strVal2, 10);
-	strcat(msgData, strVal2);
-	strcat(msgData, "\"");
+	ds_MQTT::append(msgData, size, strVal2);
+	ds_MQTT::append(msgData, size, "\"");
 
 	//  end  //
-	strcat(msgData, "}");
+	ds_MQTT::append(msgData, size, "}");
 }
 
   const Console   *_console;
   IPAddress       _server;
   PubSubClient    _client;
-  EthernetClient  _ethernetClient;
+#if DS_MQTT_SNOOP
+  ds_MQTT::session_client<typename transport::client_t> _netClient;
+#else
+  typename transport::client_t _netClient;
+#endif
   unsigned long   _lastReconnectAttempt;
   const byte      _ip_ending;
+  unsigned long   _loopLastUs;
+  unsigned long   _loopSumUs;
+  unsigned long   _loopMaxUs;
+  unsigned long   _loopCount;
+  int             _minFreeRam;
+  uint8_t         _escapes[props_count];     /// < json_escapes of each prop
+#if DS_MQTT_OWN_STATES
+  prop_state_t    _states[props_count];      /// < the network thread's copy
+  const char      *_statesPtrs[props_count];
+#endif
+#if DS_MQTT_DIRTY
+  unsigned long   _dirty[DIRTY_WORDS];       /// < bit i: prop i is to be sent
+  unsigned long   _shown[DIRTY_WORDS];       /// < bit i: _isShown(i)
+#endif
+#if DS_MQTT_DIRTY && DS_MQTT_QOS1
+  unsigned long   _changed[DIRTY_WORDS];     /// < bit i: to be sent at QoS 1
+#endif
 };
 
 
@@ -394,33 +3041,44 @@ template<size_t props_count,
          props_CBs_t *props_CBs,
          void (*special_CB)(char*, uint8_t*, unsigned int),
          const char** extra_topics,
-         const size_t extra_topics_count
+         const size_t extra_topics_count,
+         class transport
+>  typename MQTT_manager<
+  props_count, CLIENT_NAME, props_STRIDS,
+  mqtt_numbers, er_onStart, er_onReset, props_CBs,
+  special_CB, extra_topics, extra_topics_count, transport>::buffers_t MQTT_manager<
+  props_count, CLIENT_NAME, props_STRIDS,
+  mqtt_numbers, er_onStart, er_onReset, props_CBs,
+  special_CB, extra_topics, extra_topics_count, transport>::_buf;
+
+template<size_t props_count,
+         const char* CLIENT_NAME,
+         const char** props_STRIDS,
+         const int* mqtt_numbers,
+         void (*er_onStart)(),
+         void (*er_onReset)(),
+         props_CBs_t *props_CBs,
+         void (*special_CB)(char*, uint8_t*, unsigned int),
+         const char** extra_topics,
+         const size_t extra_topics_count,
+         class transport
 >  void MQTT_manager<
   props_count, CLIENT_NAME, props_STRIDS,
   mqtt_numbers, er_onStart, er_onReset, props_CBs,
-  special_CB, extra_topics, extra_topics_count>::default_msg_handler
+  special_CB, extra_topics, extra_topics_count, transport>::_dispatch
     (char* topic, uint8_t* payload, unsigned int length) 
 {
-  char* payloadStr = reinterpret_cast<char*>(payload);
-    payloadStr[length] = {0};
-    
-    for (size_t i = 0; i < props_count; ++i) {
-      char buf[32] = {"/er/"};                  /// !!! HARDCODE !!!
-      strcat(buf, props_STRIDS[i]);
-      strcat(buf, "/cmd");
-
-      if (strcmp(topic, buf) != 0 || props_CBs[i] == nullptr)
-        continue;
-
-      if (strcmp(payloadStr, "activate") == 0) {
+    int i = _propIndex(topic);
+    if (i >= 0) {
+      if (ds_MQTT::payload_is(payload, length, "activate")) {
         if((*props_CBs[i])[MQTT_CB_ACTIVATE])
           (*props_CBs[i])[MQTT_CB_ACTIVATE]();
         return;
-      } else if (strcmp(payloadStr, "finish") == 0) {
+      } else if (ds_MQTT::payload_is(payload, length, "finish")) {
         if((*props_CBs[i])[MQTT_CB_FINISH])
           (*props_CBs[i])[MQTT_CB_FINISH]();
         return;
-      } else if (strcmp(payloadStr, "reset") == 0) {
+      } else if (ds_MQTT::payload_is(payload, length, "reset")) {
         if((*props_CBs[i])[MQTT_CB_RESET])
           (*props_CBs[i])[MQTT_CB_RESET]();
         return;
@@ -428,22 +3086,42 @@ template<size_t props_count,
     }
 
     if (strcmp(topic, "/er/cmd") == 0) {
-      if (strcmp(payloadStr, "start") == 0) {
+      if (ds_MQTT::payload_is(payload, length, "start")) {
         er_onStart();
         return;
       }                                
 
-      if (strcmp(payloadStr, "reset") == 0) {
+      if (ds_MQTT::payload_is(payload, length, "reset")) {
         er_onReset();
         return;
       }                                
     }
+
+    if (DS_MQTT_DIAG && strcmp(topic, "/er/diag") == 0) {
+      _onDiag(payload, length);
+      return;
+    }
+
   #pragma GCC diagnostic ignored "-Waddress"
-    if (special_CB)
+    if (!special_CB)
   #pragma GCC diagnostic pop
-      special_CB(topic, payload, length);
+      return;
 
-    memset(payloadStr, 0, length); // todo: delete it  
+#if !DS_MQTT_THREADED  /// queued payloads are zero terminated copies already
+    /// a zero terminated copy: PubSubClient's payload may end at its buffer's end
+    char *copy = _buf.msg;
+    if (length >= BUF_SIZE) {
+      if (length >= MQTT_MAX_PACKET_SIZE) {
+        ++_errors();
+        return;
+      }
+      copy = _specialPayload();
+    }
+    memcpy(copy, payload, length);
+    copy[length] = 0;
+    payload = reinterpret_cast<uint8_t*>(copy);
+#endif
+    special_CB(topic, payload, length);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+// libFuzzer target: PubSubClient's callback with an arbitrary topic and payload
+// the input is "<topic>\0<payload>", see fuzz/README.txt
+#ifndef DS_MQTT_DEDUP
+#define DS_MQTT_DEDUP 1
+#endif
+#ifndef DS_MQTT_TRACE
+#define DS_MQTT_TRACE 1
+#endif
+#include <ds_mqtt_manager.h>
+#include <stdlib.h>
+
+constexpr size_t PROPS_NUM = 3;
+constexpr char strID[] = "fuzz";
+const char rname1[] = "door"; const char rname2[] = "_light"; const char rname3[] = "a_prop_id_of_23_chars_x";
+const char *propsNames[PROPS_NUM] = {rname1, rname2, rname3};
+constexpr int numbers[PROPS_NUM] = {1, 2, 3};
+const char topic1[] = "/er/music"; const char topic2[] = "/er/door/cmd/extra";
+const char *extraTopics[] = {topic1, topic2};
+
+void onSrt() {}
+void onRst() {}
+void on_cmd() {}
+prop_CBs_t prop_cbs = {on_cmd, on_cmd, on_cmd};
+props_CBs_t props_cbs[PROPS_NUM] = {&prop_cbs, &prop_cbs, &prop_cbs};
+
+/// reads the whole payload as a special_CB does, up to its zero terminator
+void special(char *topic, uint8_t *payload, unsigned int length)
+{
+  volatile unsigned int sum = topic[0];
+  for (unsigned int i = 0; i < length; ++i)
+    sum += payload[i];
+  if (payload[length] != 0)
+    abort();
+}
+
+typedef MQTT_manager<PROPS_NUM, strID, propsNames, numbers, onSrt, onRst, props_cbs,
+                     special, extraTopics, 2> manager_t;
+
+struct ds_mqtt_host {
+  static void handle(char *topic, uint8_t *payload, unsigned int length)
+  {
+    manager_t::default_msg_handler(topic, payload, length);
+  }
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  const uint8_t *end = static_cast<const uint8_t*>(memchr(data, 0, size));
+  size_t topicLength = end ? end - data : size;
+  size_t length = end ? size - topicLength - 1 : 0;
+
+  /// exactly sized copies, so the sanitizer sees reads past their ends
+  char *topic = static_cast<char*>(malloc(topicLength + 1));
+  memcpy(topic, data, topicLength);
+  topic[topicLength] = 0;
+  uint8_t *payload = static_cast<uint8_t*>(malloc(length ? length : 1));
+  if (length)
+    memcpy(payload, end + 1, length);
+
+  ds_mqtt_host::handle(topic, payload, length);
+
+  free(payload);
+  free(topic);
+  return 0;
+}
@@ -0,0 +1,58 @@
+// libFuzzer target: _msgInfo with an arbitrary id, status and number
+// the input is "<escape><size><number, 4 bytes><id>\0<status>", see fuzz/README.txt
+#include <ds_mqtt_manager.h>
+#include <stdlib.h>
+
+constexpr size_t PROPS_NUM = 1;
+constexpr char strID[] = "fuzz";
+const char rname1[] = "door";
+const char *propsNames[PROPS_NUM] = {rname1};
+constexpr int numbers[PROPS_NUM] = {1};
+
+void onSrt() {}
+void onRst() {}
+props_CBs_t props_cbs[PROPS_NUM] = {nullptr};
+
+typedef MQTT_manager<PROPS_NUM, strID, propsNames, numbers, onSrt, onRst, props_cbs> manager_t;
+
+struct ds_mqtt_host {
+  static void info(char *msg, size_t size, const char *id, const char *status, int number,
+                   uint8_t escape)
+  {
+    manager_t::_msgInfo(msg, size, id, status, number, escape);
+  }
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (size < 6)
+    return 0;
+  const uint8_t escape = data[0] & 3;
+  const size_t msgSize = data[1] + 1;  /// < up to 256, truncation is to be hit too
+  int number;
+  memcpy(&number, data + 2, sizeof(number));
+  data += 6;
+  size -= 6;
+
+  /// zero terminated, exactly sized copies of "<id>\0<status>"
+  const uint8_t *end = static_cast<const uint8_t*>(memchr(data, 0, size));
+  size_t idLength = end ? end - data : size;
+  size_t statusLength = end ? size - idLength - 1 : 0;
+  char *id = static_cast<char*>(malloc(idLength + 1));
+  memcpy(id, data, idLength);
+  id[idLength] = 0;
+  char *status = static_cast<char*>(malloc(statusLength + 1));
+  if (statusLength)
+    memcpy(status, end + 1, statusLength);
+  status[statusLength] = 0;
+  char *msg = static_cast<char*>(malloc(msgSize));
+
+  ds_mqtt_host::info(msg, msgSize, id, status, number, escape);
+  if (strlen(msg) >= msgSize)
+    abort();
+
+  free(msg);
+  free(status);
+  free(id);
+  return 0;
+}
@@ -0,0 +1,116 @@
+#ifndef DS_MQTT_LINUX_ARDUINO_H
+#define DS_MQTT_LINUX_ARDUINO_H
+
+/*!
+* @file minimal Arduino core for running MQTT_manager and PubSubClient
+*       as a native Linux process, see README.txt
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/// flash strings are plain ones here
+class __FlashStringHelper;
+#define F(str)                   (reinterpret_cast<const __FlashStringHelper*>(str))
+#define PSTR(str)                (str)
+#define PROGMEM
+#define pgm_read_byte(addr)      (*reinterpret_cast<const uint8_t*>(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define strcpy_P                 strcpy
+#define strlen_P                 strlen
+#define strcmp_P                 strcmp
+
+/*!
+* @brief monotonic time since the first call, the Arduino way
+*/
+inline uint64_t ds_mqtt_posix_us()
+{
+  static uint64_t start = 0;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t now = static_cast<uint64_t>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+  if (start == 0)
+    start = now;
+  return now - start;
+}
+
+inline unsigned long millis()
+{
+  return static_cast<unsigned long>(ds_mqtt_posix_us() / 1000);
+}
+
+inline unsigned long micros()
+{
+  return static_cast<unsigned long>(ds_mqtt_posix_us());
+}
+
+inline void delay(unsigned long ms)
+{
+  usleep(ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  usleep(us);
+}
+
+inline char* ultoa(unsigned long value, char *buf, int radix)
+{
+  char digits[sizeof(unsigned long) * 8 + 1];
+  size_t n = 0;
+  do {
+    unsigned digit = value % radix;
+    digits[n++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= radix;
+  } while (value);
+
+  char *p = buf;
+  while (n)
+    *p++ = digits[--n];
+  *p = 0;
+  return buf;
+}
+
+inline char* ltoa(long value, char *buf, int radix)
+{
+  if (value < 0 && radix == 10) {
+    buf[0] = '-';
+    ultoa(-static_cast<unsigned long>(value), buf + 1, radix);
+    return buf;
+  }
+  return ultoa(static_cast<unsigned long>(value), buf, radix);
+}
+
+inline char* utoa(unsigned value, char *buf, int radix)
+{
+  return ultoa(value, buf, radix);
+}
+
+inline char* itoa(int value, char *buf, int radix)
+{
+  return ltoa(value, buf, radix);
+}
+
+int ds_mqtt_posix_wait(int timeout_ms);
+
+/*!
+* @brief PubSubClient calls it while waiting for the rest of a packet
+*/
+inline void yield()
+{
+  ds_mqtt_posix_wait(1);
+}
+
+#include "Print.h"
+#include "IPAddress.h"
+#include "Stream.h"
+#include "Client.h"
+
+#endif
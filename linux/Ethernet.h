@@ -0,0 +1,299 @@
+#ifndef DS_MQTT_LINUX_ETHERNET_H
+#define DS_MQTT_LINUX_ETHERNET_H
+
+/*!
+* @file Ethernet library stand-in over POSIX sockets, see README.txt
+* @detail the sockets are non-blocking; ds_mqtt_posix_wait() sleeps in
+*         poll() on all of them, so the main loop does not spin
+*/
+#include "Arduino.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+/*!
+* @brief timeout of a broker connect and of a stalled send, ms
+*/
+#ifndef DS_MQTT_POSIX_TIMEOUT
+#define DS_MQTT_POSIX_TIMEOUT 1000
+#endif
+
+/*!
+* @brief max open EthernetClients ds_mqtt_posix_wait() polls
+*/
+#ifndef DS_MQTT_POSIX_SOCKETS
+#define DS_MQTT_POSIX_SOCKETS 8
+#endif
+
+enum EthernetHardwareStatus {
+  EthernetNoHardware,
+  EthernetW5100,
+  EthernetW5200,
+  EthernetW5500,
+  EthernetPosix
+};
+
+enum EthernetLinkStatus {
+  Unknown,
+  LinkON,
+  LinkOFF
+};
+
+/*!
+* @brief open sockets ds_mqtt_posix_wait() polls, -1 are free slots
+*/
+inline int* ds_mqtt_posix_fds()
+{
+  static int fds[DS_MQTT_POSIX_SOCKETS] = {0};
+  static bool initialized = false;
+  if (!initialized) {
+    for (size_t i = 0; i < DS_MQTT_POSIX_SOCKETS; ++i)
+      fds[i] = -1;
+    initialized = true;
+  }
+  return fds;
+}
+
+/*!
+* @brief sleeps until a socket gets readable or timeout_ms expires
+* @return poll()'s result
+* @detail call it at the end of loop() instead of a busy wait
+*/
+inline int ds_mqtt_posix_wait(int timeout_ms)
+{
+  pollfd pfds[DS_MQTT_POSIX_SOCKETS];
+  nfds_t n = 0;
+  int *fds = ds_mqtt_posix_fds();
+  for (size_t i = 0; i < DS_MQTT_POSIX_SOCKETS; ++i) {
+    if (fds[i] < 0)
+      continue;
+    pfds[n].fd = fds[i];
+    pfds[n].events = POLLIN;
+    pfds[n].revents = 0;
+    ++n;
+  }
+  if (n == 0) {
+    usleep(timeout_ms * 1000);
+    return 0;
+  }
+  return poll(pfds, n, timeout_ms);
+}
+
+class EthernetClient : public Client
+{
+public:
+  EthernetClient(): _fd(-1) {}
+  virtual ~EthernetClient() { stop(); }
+
+/*!
+* @detail DS_MQTT_BROKER=host[:port] in the environment overrides
+*         the address, the controllers' one is hardcoded
+*/
+  virtual int connect(IPAddress ip, uint16_t port)
+  {
+    char host[16];
+    return connect(ip.toString(host), port);
+  }
+
+  virtual int connect(const char *host, uint16_t port)
+  {
+    stop();
+
+    char name[64];
+    char service[8];
+    const char *broker = getenv("DS_MQTT_BROKER");
+    strncpy(name, broker ? broker : host, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    char *colon = strchr(name, ':');
+    if (colon) {
+      *colon = 0;
+      strncpy(service, colon + 1, sizeof(service) - 1);
+      service[sizeof(service) - 1] = 0;
+    } else {
+      utoa(port, service, 10);
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(name, service, &hints, &found) != 0)
+      return 0;
+
+    for (addrinfo *ai = found; ai && _fd < 0; ai = ai->ai_next)
+      _fd = _connect(ai);
+    freeaddrinfo(found);
+    if (_fd < 0)
+      return 0;
+
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    _register(_fd);
+    return 1;
+  }
+
+  virtual size_t write(uint8_t b)
+  {
+    return write(&b, 1);
+  }
+
+  virtual size_t write(const uint8_t *buf, size_t size)
+  {
+    size_t sent = 0;
+    while (_fd >= 0 && sent < size) {
+      ssize_t n = send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        sent += n;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!_waitFor(POLLOUT))
+          stop();
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        stop();
+      }
+    }
+    return sent;
+  }
+
+  virtual int available()
+  {
+    int n = 0;
+    if (_fd < 0 || ioctl(_fd, FIONREAD, &n) < 0)
+      return 0;
+    return n;
+  }
+
+  virtual int read()
+  {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+
+  virtual int read(uint8_t *buf, size_t size)
+  {
+    if (_fd < 0)
+      return -1;
+    ssize_t n = recv(_fd, buf, size, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+      stop();
+    return n > 0 ? n : -1;
+  }
+
+  virtual int peek()
+  {
+    uint8_t b;
+    if (_fd < 0 || recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+      return -1;
+    return b;
+  }
+
+  virtual void flush() {}
+
+  virtual void stop()
+  {
+    if (_fd < 0)
+      return;
+    _unregister(_fd);
+    close(_fd);
+    _fd = -1;
+  }
+
+/*!
+* @detail as on the W5500 it stays true while unread data is left
+*/
+  virtual uint8_t connected()
+  {
+    if (_fd < 0)
+      return 0;
+    uint8_t b;
+    ssize_t n = recv(_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      stop();
+      return 0;
+    }
+    return 1;
+  }
+
+  virtual operator bool() { return _fd >= 0; }
+
+  int fd() const { return _fd; }
+
+private:
+  EthernetClient(const EthernetClient&);
+  EthernetClient& operator=(const EthernetClient&);
+
+  static int _connect(const addrinfo *ai)
+  {
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+    if (fd < 0)
+      return -1;
+    if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      return fd;
+
+    int err = errno;
+    if (err == EINPROGRESS) {
+      pollfd pfd = {fd, POLLOUT, 0};
+      socklen_t len = sizeof(err);
+      if (poll(&pfd, 1, DS_MQTT_POSIX_TIMEOUT) == 1 &&
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        return fd;
+    }
+    close(fd);
+    return -1;
+  }
+
+  bool _waitFor(short events) const
+  {
+    pollfd pfd = {_fd, events, 0};
+    return poll(&pfd, 1, DS_MQTT_POSIX_TIMEOUT) == 1 && !(pfd.revents & (POLLERR | POLLHUP));
+  }
+
+  static void _register(int fd)
+  {
+    int *fds = ds_mqtt_posix_fds();
+    for (size_t i = 0; i < DS_MQTT_POSIX_SOCKETS; ++i) {
+      if (fds[i] < 0) {
+        fds[i] = fd;
+        return;
+      }
+    }
+  }
+
+  static void _unregister(int fd)
+  {
+    int *fds = ds_mqtt_posix_fds();
+    for (size_t i = 0; i < DS_MQTT_POSIX_SOCKETS; ++i) {
+      if (fds[i] == fd)
+        fds[i] = -1;
+    }
+  }
+
+  int _fd;
+};
+
+/*!
+* @brief the host's network is configured by the OS, this only reports it
+*/
+class EthernetClass
+{
+public:
+  void begin(uint8_t*, IPAddress ip) { _ip = ip; }
+  EthernetHardwareStatus hardwareStatus() const { return EthernetPosix; }
+  EthernetLinkStatus linkStatus() const { return LinkON; }
+  IPAddress localIP() const { return _ip; }
+
+private:
+  IPAddress _ip;
+};
+
+static EthernetClass Ethernet;
+
+#endif
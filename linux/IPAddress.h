@@ -0,0 +1,36 @@
+#ifndef DS_MQTT_LINUX_IPADDRESS_H
+#define DS_MQTT_LINUX_IPADDRESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+class IPAddress
+{
+public:
+  IPAddress(): _bytes{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d): _bytes{a, b, c, d} {}
+  explicit IPAddress(const uint8_t *bytes): _bytes{bytes[0], bytes[1], bytes[2], bytes[3]} {}
+
+  uint8_t operator[](int i) const { return _bytes[i]; }
+  uint8_t& operator[](int i)      { return _bytes[i]; }
+
+  bool operator==(const IPAddress &other) const
+  {
+    return _bytes[0] == other[0] && _bytes[1] == other[1] &&
+           _bytes[2] == other[2] && _bytes[3] == other[3];
+  }
+
+/*!
+* @param [out] buf at least 16 bytes
+*/
+  const char* toString(char *buf) const
+  {
+    snprintf(buf, 16, "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+    return buf;
+  }
+
+private:
+  uint8_t _bytes[4];
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef DS_MQTT_LINUX_PRINT_H
+#define DS_MQTT_LINUX_PRINT_H
+
+#include "Arduino.h"
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size-- && write(*buffer++))
+      ++n;
+    return n;
+  }
+  virtual void flush() {}
+
+  size_t write(const char *str)
+  {
+    return str ? write(reinterpret_cast<const uint8_t*>(str), strlen(str)) : 0;
+  }
+  size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char*>(str)); }
+  size_t print(const char *str)                { return write(str); }
+  size_t print(char c)                         { return write(static_cast<uint8_t>(c)); }
+  size_t print(long value)                     { char buf[24]; return write(ltoa(value, buf, 10)); }
+  size_t print(unsigned long value)            { char buf[24]; return write(ultoa(value, buf, 10)); }
+  size_t print(int value)                      { return print(static_cast<long>(value)); }
+  size_t print(unsigned value)                 { return print(static_cast<unsigned long>(value)); }
+
+  size_t println()                             { return write("\r\n"); }
+  template<typename T>
+  size_t println(const T &value)               { size_t n = print(value); return n + println(); }
+};
+
+#endif
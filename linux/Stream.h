@@ -0,0 +1,14 @@
+#ifndef DS_MQTT_LINUX_STREAM_H
+#define DS_MQTT_LINUX_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+#endif
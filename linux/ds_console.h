@@ -0,0 +1,41 @@
+#ifndef DS_MQTT_LINUX_CONSOLE_H
+#define DS_MQTT_LINUX_CONSOLE_H
+
+/*!
+* @file ds_console stand-in printing to stderr
+*/
+#include "Arduino.h"
+
+class Console
+{
+public:
+  template<typename T>
+  void print(const T &value) const
+  {
+    _print(value);
+  }
+
+  template<typename T>
+  void println(const T &value) const
+  {
+    _print(value);
+    fputc('\n', stderr);
+  }
+
+  void println() const
+  {
+    fputc('\n', stderr);
+  }
+
+private:
+  static void _print(const char *str)                { fputs(str, stderr); }
+  static void _print(const __FlashStringHelper *str) { _print(reinterpret_cast<const char*>(str)); }
+  static void _print(char c)                         { fputc(c, stderr); }
+  static void _print(long value)                     { fprintf(stderr, "%ld", value); }
+  static void _print(unsigned long value)            { fprintf(stderr, "%lu", value); }
+  static void _print(int value)                      { _print(static_cast<long>(value)); }
+  static void _print(unsigned value)                 { _print(static_cast<unsigned long>(value)); }
+  static void _print(const IPAddress &ip)            { char buf[16]; _print(ip.toString(buf)); }
+};
+
+#endif
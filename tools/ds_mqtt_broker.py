@@ -0,0 +1,381 @@
+#!/usr/bin/env python3
+"""Minimal MQTT 3.1.1 broker stand-in with fault injection.
+
+Good enough to run MQTT_manager host builds, the tools and benchmarks
+against without a real broker: CONNECT/CONNACK, SUBSCRIBE with '+' and '#',
+PUBLISH QoS 0/1 (granted QoS is capped to 1), retained msgs, last will,
+keepalive, PINGREQ, UNSUBSCRIBE, DISCONNECT; persistent sessions (clean
+session 0) keep their subscriptions and queue the QoS 1 msgs while the
+client is away, CONNACK reports them as session present.
+
+Faults are injected on the broker side:
+  --drop P        drop a routed publish with probability P
+  --delay MS      delay every routed publish by MS (+ --jitter MS)
+  --refuse P      refuse a CONNECT (rc 3, server unavailable) with probability P
+  --kick S        drop every connection after S seconds
+
+--record FILE writes every publish in the ds_mqtt_replay.py capture format.
+
+It can also be used in-process from other tools:
+    broker = Broker(Faults())
+    server = await broker.serve("127.0.0.1", 1883)
+
+usage: ds_mqtt_broker.py [--port 1883] [--drop 0.1] [--delay 50] [-v]
+"""
+import argparse
+import asyncio
+import random
+import struct
+import sys
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK = 8, 9, 10, 11
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+def topic_matches(topic_filter, topic):
+    """MQTT 3.1.1 section 4.7 matching of '+' and '#'"""
+    if topic_filter.startswith(("+", "#")) and topic.startswith("$"):
+        return False
+    filter_levels = topic_filter.split("/")
+    topic_levels = topic.split("/")
+    for i, level in enumerate(filter_levels):
+        if level == "#":
+            return True
+        if i >= len(topic_levels):
+            return False
+        if level != "+" and level != topic_levels[i]:
+            return False
+    return len(filter_levels) == len(topic_levels)
+
+
+def encode_length(length):
+    out = bytearray()
+    while True:
+        byte, length = length % 128, length // 128
+        out.append(byte | (0x80 if length else 0))
+        if not length:
+            return bytes(out)
+
+
+def packet(kind, flags, body=b""):
+    return bytes([kind << 4 | flags]) + encode_length(len(body)) + body
+
+
+def utf8(data):
+    data = data.encode() if isinstance(data, str) else data
+    return struct.pack("!H", len(data)) + data
+
+
+def publish_packet(topic, payload, qos=0, retain=False, packet_id=0, dup=False):
+    body = utf8(topic)
+    if qos:
+        body += struct.pack("!H", packet_id)
+    flags = (dup << 3) | (qos << 1) | retain
+    return packet(PUBLISH, flags, body + payload)
+
+
+async def read_packet(reader):
+    """returns (type, flags, body)"""
+    header = (await reader.readexactly(1))[0]
+    length, multiplier = 0, 1
+    for _ in range(4):
+        byte = (await reader.readexactly(1))[0]
+        length += (byte & 0x7F) * multiplier
+        multiplier *= 128
+        if not byte & 0x80:
+            break
+    else:
+        raise ValueError("malformed remaining length")
+    body = await reader.readexactly(length) if length else b""
+    return header >> 4, header & 0x0F, body
+
+
+class Faults:
+    def __init__(self, drop=0.0, delay_ms=0, jitter_ms=0, refuse=0.0, kick_s=0):
+        self.drop = drop
+        self.delay_ms = delay_ms
+        self.jitter_ms = jitter_ms
+        self.refuse = refuse
+        self.kick_s = kick_s
+
+    def delay(self):
+        return (self.delay_ms + random.uniform(0, self.jitter_ms)) / 1000
+
+
+class Session:
+    def __init__(self, broker, reader, writer):
+        self.broker = broker
+        self.reader = reader
+        self.writer = writer
+        self.client_id = None
+        self.subscriptions = {}  # filter -> granted qos
+        self.will = None         # (topic, payload, qos, retain)
+        self.keepalive = 0
+        self.next_id = 1
+        self.clean = True
+
+    def send(self, data):
+        if not self.writer.is_closing():
+            self.writer.write(data)
+
+    def deliver(self, topic, payload, qos, retain=False):
+        """returns False if no subscription matches"""
+        granted = max((q for f, q in self.subscriptions.items()
+                       if topic_matches(f, topic)), default=None)
+        if granted is None:
+            return False
+        qos = min(qos, granted)
+        packet_id = 0
+        if qos:
+            packet_id, self.next_id = self.next_id, self.next_id % 0xFFFF + 1
+        self.send(publish_packet(topic, payload, qos, retain, packet_id))
+        return True
+
+    async def run(self):
+        broker = self.broker
+        clean_exit = False
+        try:
+            kind, _, body = await asyncio.wait_for(read_packet(self.reader), 10)
+            if kind != CONNECT or not self.on_connect(body):
+                return
+            broker.stats["connects"] += 1
+            while True:
+                timeout = self.keepalive * 1.5 if self.keepalive else None
+                kind, flags, body = await asyncio.wait_for(read_packet(self.reader), timeout)
+                if kind == PUBLISH:
+                    await self.on_publish(flags, body)
+                elif kind == SUBSCRIBE:
+                    self.on_subscribe(body)
+                elif kind == UNSUBSCRIBE:
+                    self.on_unsubscribe(body)
+                elif kind == PINGREQ:
+                    self.send(packet(PINGRESP, 0))
+                elif kind == DISCONNECT:
+                    clean_exit = True
+                    return
+                # PUBACKs of the QoS 1 deliveries are not tracked
+        except (asyncio.IncompleteReadError, asyncio.TimeoutError,
+                ConnectionError, ValueError, struct.error):
+            pass
+        finally:
+            broker.detach(self, clean_exit)
+            self.writer.close()
+
+    def on_connect(self, body):
+        name_len = struct.unpack_from("!H", body)[0]
+        pos = 2 + name_len
+        level, flags, self.keepalive = struct.unpack_from("!BBH", body, pos)
+        pos += 4
+        if level != 4:
+            self.send(packet(CONNACK, 0, b"\x00\x01"))
+            return False
+
+        def field():
+            nonlocal pos
+            size = struct.unpack_from("!H", body, pos)[0]
+            data = body[pos + 2:pos + 2 + size]
+            pos += 2 + size
+            return data
+
+        self.client_id = field().decode(errors="replace")
+        self.clean = bool(flags & 0x02)
+        if flags & 0x04:
+            will_topic = field().decode(errors="replace")
+            self.will = (will_topic, field(), (flags >> 3) & 3, bool(flags & 0x20))
+
+        if random.random() < self.broker.faults.refuse:
+            self.broker.stats["refused"] += 1
+            self.send(packet(CONNACK, 0, b"\x00\x03"))
+            return False
+
+        queued = self.broker.attach(self)
+        self.send(packet(CONNACK, 0, bytes([queued is not None, 0])))
+        for topic, payload, qos in queued or ():
+            self.deliver(topic, payload, qos)
+        return True
+
+    async def on_publish(self, flags, body):
+        qos = (flags >> 1) & 3
+        retain = bool(flags & 1)
+        topic_len = struct.unpack_from("!H", body)[0]
+        topic = body[2:2 + topic_len].decode(errors="replace")
+        pos = 2 + topic_len
+        if qos:
+            packet_id = struct.unpack_from("!H", body, pos)[0]
+            pos += 2
+            self.send(packet(PUBACK, 0, struct.pack("!H", packet_id)))
+        await self.broker.route(topic, body[pos:], qos, retain, self)
+
+    def on_subscribe(self, body):
+        packet_id = struct.unpack_from("!H", body)[0]
+        pos, granted, filters = 2, bytearray(), []
+        while pos < len(body):
+            size = struct.unpack_from("!H", body, pos)[0]
+            topic_filter = body[pos + 2:pos + 2 + size].decode(errors="replace")
+            qos = min(body[pos + 2 + size] & 3, 1)
+            pos += 3 + size
+            self.subscriptions[topic_filter] = qos
+            self.broker.index(self, topic_filter)
+            granted.append(qos)
+            filters.append(topic_filter)
+        self.broker.stats["subscribes"] += len(filters)
+        self.send(packet(SUBACK, 0, struct.pack("!H", packet_id) + bytes(granted)))
+        for topic_filter in filters:
+            self.broker.send_retained(self, topic_filter)
+
+    def on_unsubscribe(self, body):
+        packet_id = struct.unpack_from("!H", body)[0]
+        pos = 2
+        while pos < len(body):
+            size = struct.unpack_from("!H", body, pos)[0]
+            topic_filter = body[pos + 2:pos + 2 + size].decode(errors="replace")
+            if self.subscriptions.pop(topic_filter, None) is not None:
+                self.broker.unindex(self, topic_filter)
+            pos += 2 + size
+        self.send(packet(UNSUBACK, 0, struct.pack("!H", packet_id)))
+
+
+class Broker:
+    def __init__(self, faults=None, verbose=False):
+        self.faults = faults or Faults()
+        self.verbose = verbose
+        self.sessions = {}  # client id -> Session
+        self.retained = {}  # topic -> (payload, qos)
+        self.recorder = None  # ds_mqtt_replay.CaptureWriter
+        self.persistent = {}  # client id -> (subscriptions, [(topic, payload, qos)]) while away
+        self.exact = {}       # filter without wildcards -> {Session: count}
+        self.wildcard = {}    # Session -> count of its wildcard filters
+        self.stats = {"connects": 0, "refused": 0, "subscribes": 0,
+                      "published": 0, "delivered": 0, "dropped": 0, "wills": 0,
+                      "queued": 0}
+
+    def log(self, *args):
+        if self.verbose:
+            print("%.3f" % time.monotonic(), *args, file=sys.stderr)
+
+    def attach(self, session):
+        """returns the msgs queued for a present session, None if there is none"""
+        old = self.sessions.get(session.client_id)
+        if old is not None:  # session takeover
+            old.will = None
+            old.clean = True  # the new connection decides what is kept
+            old.writer.close()
+        self.sessions[session.client_id] = session
+        self.log("connect", session.client_id)
+        if self.faults.kick_s:
+            asyncio.get_running_loop().call_later(self.faults.kick_s, session.writer.close)
+
+        stored = self.persistent.pop(session.client_id, None)
+        if session.clean or stored is None:
+            return None
+        session.subscriptions = stored[0]
+        for topic_filter in session.subscriptions:
+            self.index(session, topic_filter)
+        return stored[1]
+
+    def index(self, session, topic_filter):
+        """routing index, a publish is matched against its candidates only"""
+        if "+" in topic_filter or "#" in topic_filter:
+            self.wildcard[session] = self.wildcard.get(session, 0) + 1
+        else:
+            self.exact.setdefault(topic_filter, set()).add(session)
+
+    def unindex(self, session, topic_filter):
+        if "+" in topic_filter or "#" in topic_filter:
+            self.wildcard[session] -= 1
+            if not self.wildcard[session]:
+                del self.wildcard[session]
+        else:
+            subscribers = self.exact.get(topic_filter, set())
+            subscribers.discard(session)
+            if not subscribers:
+                self.exact.pop(topic_filter, None)
+
+    def detach(self, session, clean_exit):
+        if self.sessions.get(session.client_id) is session:
+            del self.sessions[session.client_id]
+        for topic_filter in session.subscriptions:
+            self.unindex(session, topic_filter)
+        if not session.clean and session.client_id not in self.sessions:
+            self.persistent[session.client_id] = (session.subscriptions, [])
+        session.subscriptions = {}
+        self.log("disconnect", session.client_id, "clean" if clean_exit else "lost")
+        if session.will and not clean_exit:
+            self.stats["wills"] += 1
+            topic, payload, qos, retain = session.will
+            asyncio.ensure_future(self.route(topic, payload, qos, retain, None))
+
+    def send_retained(self, session, topic_filter):
+        for topic, (payload, qos) in self.retained.items():
+            if topic_matches(topic_filter, topic):
+                session.deliver(topic, payload, qos, retain=True)
+
+    async def route(self, topic, payload, qos, retain, sender):
+        self.stats["published"] += 1
+        if self.verbose:
+            self.log("publish", topic, payload[:64])
+        if self.recorder:
+            self.recorder.write(topic, payload)
+        if retain:
+            if payload:
+                self.retained[topic] = (payload, qos)
+            else:
+                self.retained.pop(topic, None)
+        if random.random() < self.faults.drop:
+            self.stats["dropped"] += 1
+            return
+        delay = self.faults.delay()
+        if delay:
+            await asyncio.sleep(delay)
+        for session in self.exact.get(topic, set()) | set(self.wildcard):
+            if session.deliver(topic, payload, qos):
+                self.stats["delivered"] += 1
+        for subscriptions, queue in self.persistent.values():
+            granted = max((q for f, q in subscriptions.items()
+                           if topic_matches(f, topic)), default=0)
+            if min(qos, granted):
+                queue.append((topic, payload, 1))
+                self.stats["queued"] += 1
+
+    async def serve(self, host="127.0.0.1", port=1883):
+        async def on_client(reader, writer):
+            try:
+                await Session(self, reader, writer).run()
+            except asyncio.CancelledError:  # the loop is shutting down
+                writer.close()
+        return await asyncio.start_server(on_client, host, port)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--drop", type=float, default=0.0)
+    parser.add_argument("--delay", type=int, default=0, help="ms")
+    parser.add_argument("--jitter", type=int, default=0, help="ms")
+    parser.add_argument("--refuse", type=float, default=0.0)
+    parser.add_argument("--kick", type=float, default=0, help="s")
+    parser.add_argument("--record", metavar="FILE")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    broker = Broker(Faults(args.drop, args.delay, args.jitter, args.refuse, args.kick),
+                    args.verbose)
+    if args.record:
+        from ds_mqtt_replay import CaptureWriter
+        broker.recorder = CaptureWriter(args.record)
+    server = await broker.serve(args.host, args.port)
+    try:
+        async with server:
+            await server.serve_forever()
+    finally:
+        print(broker.stats, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,114 @@
+"""Minimal asyncio MQTT 3.1.1 client for the tools.
+
+Publishes at QoS 0 or 1 (PUBACKs are not awaited), QoS 1 msgs are
+received and acknowledged; keepalive pings, last will, clean session
+on or off. Received msgs are passed to on_message(topic, payload).
+"""
+import asyncio
+import struct
+
+from ds_mqtt_broker import (CONNACK, CONNECT, DISCONNECT, PINGREQ, PUBACK,
+                            PUBLISH, SUBSCRIBE, packet, publish_packet,
+                            read_packet, utf8)
+
+
+class MqttError(Exception):
+    pass
+
+
+class MqttClient:
+    def __init__(self, client_id, on_message=None, keepalive=15, will=None, clean=True):
+        self.client_id = client_id
+        self.on_message = on_message
+        self.keepalive = keepalive
+        self.will = will  # (topic, payload)
+        self.clean = clean
+        self.session_present = False
+        self.reader = None
+        self.writer = None
+        self.next_id = 1
+        self.tasks = []
+
+    async def connect(self, host="127.0.0.1", port=1883):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+        flags, payload = 0x02 if self.clean else 0, utf8(self.client_id)
+        if self.will:
+            flags |= 0x04
+            payload += utf8(self.will[0]) + utf8(self.will[1])
+        self.writer.write(packet(CONNECT, 0, utf8("MQTT") + bytes([4, flags])
+                                 + struct.pack("!H", self.keepalive) + payload))
+        kind, _, body = await read_packet(self.reader)
+        if kind != CONNACK or body[1] != 0:
+            self.writer.close()
+            raise MqttError("connection refused, rc %d" % body[1])
+        self.session_present = bool(body[0] & 0x01)
+        self.tasks = [asyncio.ensure_future(self._read_loop()),
+                      asyncio.ensure_future(self._ping_loop())]
+
+    @property
+    def connected(self):
+        return self.writer is not None and not self.writer.is_closing()
+
+    def publish(self, topic, payload, retain=False, qos=0):
+        """QoS 1 msgs are sent once, their PUBACKs are not awaited"""
+        if isinstance(payload, str):
+            payload = payload.encode()
+        if not self.connected:
+            return False
+        packet_id = 0
+        if qos:
+            packet_id, self.next_id = self.next_id, self.next_id % 0xFFFF + 1
+        self.writer.write(publish_packet(topic, payload, min(qos, 1), retain, packet_id))
+        return True
+
+    def subscribe(self, *topic_filters, qos=0):
+        packet_id, self.next_id = self.next_id, self.next_id % 0xFFFF + 1
+        body = struct.pack("!H", packet_id)
+        for topic_filter in topic_filters:
+            body += utf8(topic_filter) + bytes([qos])
+        self.writer.write(packet(SUBSCRIBE, 2, body))
+
+    async def drain(self):
+        if self.connected:
+            await self.writer.drain()
+
+    async def disconnect(self):
+        if self.connected:
+            self.writer.write(packet(DISCONNECT, 0))
+            await self.writer.drain()
+        self.close()
+
+    def close(self):
+        for task in self.tasks:
+            task.cancel()
+        if self.writer is not None:
+            self.writer.close()
+
+    async def wait_closed(self):
+        await asyncio.gather(*self.tasks, return_exceptions=True)
+
+    async def _read_loop(self):
+        try:
+            while True:
+                kind, flags, body = await read_packet(self.reader)
+                if kind != PUBLISH:
+                    continue  # SUBACK, PINGRESP
+                topic_len = struct.unpack_from("!H", body)[0]
+                pos = 2 + topic_len
+                if (flags >> 1) & 3:
+                    self.writer.write(packet(PUBACK, 0, body[pos:pos + 2]))
+                    pos += 2
+                if self.on_message:
+                    self.on_message(body[2:2 + topic_len].decode(errors="replace"), body[pos:])
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            self.writer.close()
+
+    async def _ping_loop(self):
+        while self.keepalive:
+            await asyncio.sleep(self.keepalive / 2)
+            if not self.connected:
+                return
+            self.writer.write(packet(PINGREQ, 0))
+
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""Virtual controller fleet for broker and ERP load tests.
+
+Runs many simulated MQTT_manager controllers in one event loop. They do
+not run the header: the protocol below is mirrored by hand, so it has to
+follow the header's changes, and the health msgs carry fake ram and loop
+values. On the wire each behaves like the header does:
+  - connects as its CLIENT_NAME ("sim_<n>"), first attempt 5 s after
+    boot, then every 5 s while disconnected; keepalive 15 s
+  - subscribes to "/er/<prop>/cmd" per prop and "/er/cmd", one by one
+  - publishes a "/er/riddles/info" msg per prop every second and a
+    "/er/health" msg every --health seconds
+  - "activate"/"finish"/"reset" to a prop's topic change its state,
+    "reset" to /er/cmd resets every prop (the usual er_onReset)
+  - a command's "#<seq>" suffix ("activate#12", see DS_MQTT_DEDUP) is
+    stripped
+
+A driver client plays the ERP: it counts what reaches it, sends
+--commands random prop commands per second as "<verb>#<seq>", so real
+controllers can share the broker, and measures their latency (driver
+publish -> controller receive of the seq, a single clock).
+
+usage: ds_mqtt_fleet.py [--controllers 60] [--props 20] [--duration 60]
+                        [--commands 10] [--ramp 5] [--host 127.0.0.1]
+Thousands of controllers need a raised open files limit (ulimit -n).
+"""
+import argparse
+import asyncio
+import json
+import random
+import sys
+import time
+
+from ds_mqtt_client import MqttClient, MqttError
+
+READY, ENABLED, FINISHED = "Not activated", "Activated", "Finished"
+STATES = {b"activate": ENABLED, b"finish": FINISHED, b"reset": READY}
+
+RECONNECT_PERIOD = 5.0
+INFO_PERIOD = 1.0
+KEEPALIVE = 15
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+class Stats:
+    def __init__(self):
+        self.connects = 0
+        self.failed = 0
+        self.lost = 0
+        self.published = 0
+        self.received = 0   # by the driver
+        self.commands = 0
+        self.latencies = []  # ms
+        self.sent = {}       # seq: the driver's publish time
+
+    def snapshot(self):
+        return dict(self.__dict__, latencies=list(self.latencies), sent=None)
+
+
+class VirtualController:
+    def __init__(self, index, props, args, stats):
+        self.name = "sim_%03d" % index
+        self.props = ["sim%03d_prop_%02d" % (index, i) for i in range(props)]
+        self.numbers = [index * props + i + 1 for i in range(props)]
+        self.states = [READY] * props
+        self.topics = {"/er/%s/cmd" % prop: i for i, prop in enumerate(self.props)}
+        self.args = args
+        self.stats = stats
+        self.client = None
+        self.boot = time.monotonic()
+
+    def info(self, i):
+        """the _msgInfo format"""
+        prop = self.props[i]
+        name = prop.replace("_", " ")
+        return ('{"strId":"%s", "strName":"%s", "strStatus":"%s", "number":"%d"}'
+                % (prop, name[:1].upper() + name[1:], self.states[i], self.numbers[i]))
+
+    def health(self):
+        return json.dumps({"id": self.name, "up": int(time.monotonic() - self.boot),
+                           "ram": 2048, "ramMin": 1900, "loopAvg": 120,
+                           "loopMax": 2500, "reset": "por"}, separators=(",", ":"))
+
+    def publish(self, topic, payload):
+        if self.client is not None and self.client.publish(topic, payload):
+            self.stats.published += 1
+
+    def on_message(self, topic, payload):
+        verb, hash_, seq = payload.rpartition(b"#")
+        if hash_ and seq.isdigit() and len(seq) <= 9:  # the header's "#<seq>" suffix
+            payload = verb
+            sent = self.stats.sent.pop(int(seq), None)
+            if sent is not None:
+                self.stats.latencies.append((time.monotonic() - sent) * 1000)
+        i = self.topics.get(topic)
+        if i is not None and payload in STATES:
+            self.states[i] = STATES[payload]
+        elif topic == "/er/cmd" and payload == b"reset":
+            self.states = [READY] * len(self.props)
+
+    async def run(self):
+        await asyncio.gather(self._connection(), self._publisher())
+
+    async def _connection(self):
+        await asyncio.sleep(RECONNECT_PERIOD)
+        while True:
+            client = MqttClient(self.name, self.on_message, KEEPALIVE)
+            try:
+                await client.connect(self.args.host, self.args.port)
+            except (OSError, MqttError, asyncio.IncompleteReadError):
+                self.stats.failed += 1
+                await asyncio.sleep(RECONNECT_PERIOD)
+                continue
+            self.stats.connects += 1
+            for topic in self.topics:
+                client.subscribe(topic)
+            client.subscribe("/er/cmd")
+            self.client = client
+            await client.wait_closed()
+            self.client = None
+            self.stats.lost += 1
+            await asyncio.sleep(RECONNECT_PERIOD)
+
+    async def _publisher(self):
+        last_health = time.monotonic()
+        while True:
+            await asyncio.sleep(INFO_PERIOD)
+            for i in range(len(self.props)):
+                if not self.props[i].startswith("_"):
+                    self.publish("/er/riddles/info", self.info(i))
+            if self.args.health and time.monotonic() - last_health > self.args.health:
+                self.publish("/er/health", self.health())
+                last_health = time.monotonic()
+            if self.client is not None:
+                await self.client.drain()
+
+
+async def drive(controllers, args, stats):
+    """the ERP side: counts the msgs and sends "<verb>#<seq>" commands"""
+    def on_message(topic, payload):
+        stats.received += 1
+
+    seq = 0
+
+    while True:
+        driver = MqttClient("ds_mqtt_fleet_erp", on_message, KEEPALIVE)
+        try:
+            await driver.connect(args.host, args.port)
+        except (OSError, MqttError, asyncio.IncompleteReadError):
+            await asyncio.sleep(RECONNECT_PERIOD)
+            continue
+        driver.subscribe("/er/riddles/info", "/er/health")
+        try:
+            while driver.connected:
+                if not args.commands:
+                    await driver.wait_closed()
+                    break
+                await asyncio.sleep(1 / args.commands)
+                controller = random.choice(controllers)
+                topic = random.choice(list(controller.topics))
+                verb = random.choice(list(STATES)).decode()
+                seq = seq % 999999999 + 1
+                stats.sent[seq] = time.monotonic()
+                if driver.publish(topic, "%s#%d" % (verb, seq)):
+                    stats.commands += 1
+                else:
+                    del stats.sent[seq]
+                await driver.drain()
+        except ConnectionError:
+            pass
+        finally:
+            driver.close()
+
+
+def report(stats, last, period, online):
+    latencies = stats.latencies[len(last["latencies"]):]
+    print("online %4d  connects %4d  failed %4d  lost %4d  sent %7.0f/s  erp %7.0f/s"
+          "  cmd p50 %6.1f p99 %6.1f max %6.1f ms"
+          % (online, stats.connects, stats.failed, stats.lost,
+             (stats.published - last["published"]) / period,
+             (stats.received - last["received"]) / period,
+             percentile(latencies, 50), percentile(latencies, 99),
+             max(latencies, default=0.0)))
+    sys.stdout.flush()
+
+
+async def main(args):
+    stats = Stats()
+    controllers = [VirtualController(n, args.props, args, stats)
+                   for n in range(args.controllers)]
+
+    async def boot(controller, delay):
+        await asyncio.sleep(delay)
+        controller.boot = time.monotonic()
+        await controller.run()
+
+    tasks = [asyncio.ensure_future(boot(c, random.uniform(0, args.ramp))) for c in controllers]
+    tasks.append(asyncio.ensure_future(drive(controllers, args, stats)))
+
+    start = time.monotonic()
+    last = stats.snapshot()
+    try:
+        while time.monotonic() - start < args.duration:
+            await asyncio.sleep(args.report)
+            online = sum(c.client is not None for c in controllers)
+            report(stats, last, args.report, online)
+            last = stats.snapshot()
+    finally:
+        for task in tasks:
+            task.cancel()
+        await asyncio.gather(*tasks, return_exceptions=True)
+
+    print("total: %d controllers x %d props, %d connects, %d failed, %d lost, "
+          "%d published, %d at the erp, %d commands, latency p50 %.1f p99 %.1f ms"
+          % (args.controllers, args.props, stats.connects, stats.failed, stats.lost,
+             stats.published, stats.received, stats.commands,
+             percentile(stats.latencies, 50), percentile(stats.latencies, 99)))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--controllers", type=int, default=60)
+    parser.add_argument("--props", type=int, default=20)
+    parser.add_argument("--duration", type=float, default=60, help="s")
+    parser.add_argument("--ramp", type=float, default=5, help="boots spread over, s")
+    parser.add_argument("--health", type=float, default=30, help="s, 0 turns it off")
+    parser.add_argument("--commands", type=float, default=10, help="per s, 0 turns them off")
+    parser.add_argument("--report", type=float, default=5, help="s")
+    try:
+        asyncio.run(main(parser.parse_args()))
+    except KeyboardInterrupt:
+        pass
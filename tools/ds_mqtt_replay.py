@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Records MQTT traffic of a game session and replays it.
+
+Capture format: JSON lines
+    {"t": <ms since the first msg>, "dir": "in"|"out", "topic": ..., "payload": ...}
+"in" are msgs to the controllers (.../cmd, /er/diag), "out" the ones
+from them; the payload is latin-1 decoded to keep arbitrary bytes.
+The broker stand-in writes the same format with --record.
+
+record: subscribes to the filter and writes every msg until Ctrl-C
+    ds_mqtt_replay.py record session.jsonl [--filter /er/#]
+replay: publishes the "in" msgs (--all: every msg) at the recorded pace
+divided by --speed, then asks the controllers for their profiles
+(DS_MQTT_PROFILE builds) and prints the dispatch latency percentiles
+    ds_mqtt_replay.py replay session.jsonl [--speed 10] [--all]
+"""
+import argparse
+import asyncio
+import json
+import sys
+import time
+
+from ds_mqtt_client import MqttClient
+
+
+def direction(topic):
+    return "in" if topic.endswith("/cmd") or topic == "/er/diag" else "out"
+
+
+class CaptureWriter:
+    def __init__(self, path):
+        self.file = open(path, "w")
+        self.start = None
+
+    def write(self, topic, payload):
+        now = time.monotonic()
+        if self.start is None:
+            self.start = now
+        record = {"t": round((now - self.start) * 1000, 3), "dir": direction(topic),
+                  "topic": topic, "payload": payload.decode("latin-1")}
+        self.file.write(json.dumps(record) + "\n")
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+def read_capture(path):
+    with open(path) as capture:
+        return [json.loads(line) for line in capture if line.strip()]
+
+
+async def record(args):
+    writer = CaptureWriter(args.capture)
+    client = MqttClient("ds_mqtt_recorder", lambda t, p: writer.write(t, p))
+    await client.connect(args.host, args.port)
+    client.subscribe(args.filter)
+    try:
+        await client.wait_closed()
+    finally:
+        writer.close()
+
+
+async def replay(args):
+    records = [r for r in read_capture(args.capture) if args.all or r["dir"] == "in"]
+    reports = []
+
+    def on_report(topic, payload):
+        try:
+            reports.append(json.loads(payload))
+        except ValueError:
+            pass
+
+    client = MqttClient("ds_mqtt_replayer", on_report)
+    await client.connect(args.host, args.port)
+    client.subscribe("/er/diag/info")
+    client.publish("/er/diag", "profile_reset")
+
+    start = time.monotonic()
+    lag_max = 0.0
+    for record in records:
+        due = start + record["t"] / 1000 / args.speed
+        delay = due - time.monotonic()
+        if delay > 0:
+            await asyncio.sleep(delay)
+        else:
+            lag_max = max(lag_max, -delay)
+        client.publish(record["topic"], record["payload"].encode("latin-1"))
+        await client.drain()
+    print("replayed %d msgs in %.1f s (x%g), max lag %.1f ms"
+          % (len(records), time.monotonic() - start, args.speed, lag_max * 1000))
+
+    client.publish("/er/diag", "profile")
+    await asyncio.sleep(args.wait)
+    await client.disconnect()
+
+    for report in reports:
+        if report.get("sec") in ("dispatch", "dispatch_pct"):
+            print(json.dumps(report))
+    if not reports:
+        print("no profile reports, are the controllers built with DS_MQTT_PROFILE?",
+              file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("mode", choices=("record", "replay"))
+    parser.add_argument("capture")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--filter", default="/er/#")
+    parser.add_argument("--speed", type=float, default=1.0)
+    parser.add_argument("--all", action="store_true", help="replay the \"out\" msgs too")
+    parser.add_argument("--wait", type=float, default=2.0,
+                        help="seconds to wait for the profile reports")
+    args = parser.parse_args()
+    try:
+        asyncio.run(record(args) if args.mode == "record" else replay(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
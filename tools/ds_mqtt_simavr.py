@@ -0,0 +1,330 @@
+#!/usr/bin/env python3
+"""Cycle counts of MQTT_manager under simavr.
+
+Builds an instrumented sketch (DS_MQTT_PROFILE, DS_MQTT_CYCLES,
+DS_MQTT_BENCH) with arduino-cli and runs it in simavr. The sketch's
+transport policy is a scripted broker in the sketch itself, so no network
+is simulated:
+  - CONNECT, SUBSCRIBE and PINGREQ get their replies
+  - once subscribed, a command goes to a prop every --period ms,
+    activate/finish/reset in turn
+  - after every --drop commands the connection is dropped, so
+    MQTT_manager reconnects (after its 5 s retry period)
+  - after --commands commands "profile" and "bench" go to /er/diag
+The profile and bench msgs the controller echoes to its UART are parsed
+into a report of cycles per dispatch, heartbeat (info), reconnect
+(connect) and the benchmark cases.
+
+The libraries the header includes (Ethernet, PubSubClient, ds_console)
+have to be installed for arduino-cli.
+
+usage: ds_mqtt_simavr.py [--fqbn arduino:avr:mega] [--mcu atmega2560]
+                         [--props 8] [--commands 200] [--json report.json]
+"""
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DONE = "DS_MQTT_SIM_DONE"
+
+SKETCH = """\
+#define DS_MQTT_PROFILE 1
+#define DS_MQTT_CYCLES 1
+#define DS_MQTT_BENCH 1
+#include <ds_mqtt_manager.h>
+
+constexpr size_t PROPS_NUM = {props};
+constexpr char strID[] = "simavr";
+constexpr unsigned long COMMAND_PERIOD = {period};  // ms
+constexpr unsigned int COMMANDS = {commands};
+constexpr unsigned int DROP_EVERY = {drop};
+
+{names}
+const char *propsNames[PROPS_NUM] = {{ {name_list} }};
+constexpr int riddles_num_in_ERP[PROPS_NUM] = {{ {numbers} }};
+
+void onSrt() {{}}
+void onRst() {{}}
+void on_a() {{}}
+void on_f() {{}}
+void on_r() {{}}
+prop_CBs_t prop_cbs = {{ on_a, on_f, on_r }};
+props_CBs_t props_cbs[PROPS_NUM] = {{ {cbs_list} }};
+
+{states}
+props_states_t props_states[PROPS_NUM] = {{ {state_list} }};
+
+/// the scripted broker's state, shared by the manager's client and loop()
+struct sim_broker_t {{
+  bool     connected;
+  bool     subscribed;
+  uint8_t  in[256];         // bytes to the controller
+  uint8_t  head, tail;
+  uint8_t  type, pos;       // the packet being written by the controller
+  uint16_t remaining;
+  uint8_t  shift;
+  bool     length;
+  uint8_t  id[2];
+  unsigned int commands;
+  unsigned long last;
+  uint8_t  finale;
+}};
+static sim_broker_t sim;
+
+static void sim_put(uint8_t b) {{ sim.in[sim.head++] = b; }}
+
+static void sim_publish(const char *topic, const char *payload)
+{{
+  uint8_t topicLength = strlen(topic), payloadLength = strlen(payload);
+  sim_put(0x30);
+  sim_put(2 + topicLength + payloadLength);
+  sim_put(0);
+  sim_put(topicLength);
+  while (*topic) sim_put(*topic++);
+  while (*payload) sim_put(*payload++);
+}}
+
+/// replies to a packet written by the controller once its body is known
+static void sim_reply()
+{{
+  switch (sim.type) {{
+  case 1: sim_put(0x20); sim_put(2); sim_put(0); sim_put(0); break;             // CONNACK
+  case 8: sim_put(0x90); sim_put(3); sim_put(sim.id[0]); sim_put(sim.id[1]);   // SUBACK
+          sim_put(0); sim.subscribed = true; break;
+  case 12: sim_put(0xD0); sim_put(0); break;                                   // PINGRESP
+  case 14: sim.connected = false; break;                                       // DISCONNECT
+  }}
+}}
+
+static void sim_write(uint8_t b)
+{{
+  if (sim.type == 0) {{
+    sim.type = b >> 4;
+    sim.remaining = sim.shift = sim.pos = 0;
+    sim.length = true;
+    return;
+  }}
+  if (sim.length) {{
+    sim.remaining |= (b & 0x7F) << sim.shift;
+    sim.shift += 7;
+    if (b & 0x80)
+      return;
+    sim.length = false;
+    if (sim.remaining == 0) {{
+      sim_reply();
+      sim.type = 0;
+    }}
+    return;
+  }}
+  if (sim.type == 8 && sim.pos < 2)
+    sim.id[sim.pos] = b;
+  ++sim.pos;
+  if (--sim.remaining == 0) {{
+    sim_reply();
+    sim.type = 0;
+  }}
+}}
+
+/// the transport's client: the scripted broker instead of a socket
+class SimClient : public Client {{
+public:
+  int connect(IPAddress, uint16_t) override {{ return _connect(); }}
+  int connect(const char *, uint16_t) override {{ return _connect(); }}
+  size_t write(uint8_t b) override {{ if (sim.connected) sim_write(b); return 1; }}
+  size_t write(const uint8_t *buf, size_t size) override
+  {{
+    for (size_t i = 0; i < size; ++i)
+      write(buf[i]);
+    return size;
+  }}
+  int available() override {{ return sim.connected ? static_cast<uint8_t>(sim.head - sim.tail) : 0; }}
+  int read() override {{ return available() ? sim.in[sim.tail++] : -1; }}
+  int read(uint8_t *buf, size_t size) override
+  {{
+    size_t n = 0;
+    while (n < size && available())
+      buf[n++] = sim.in[sim.tail++];
+    return n;
+  }}
+  int peek() override {{ return available() ? sim.in[sim.tail] : -1; }}
+  void flush() override {{}}
+  void stop() override {{ sim.connected = false; }}
+  uint8_t connected() override {{ return sim.connected; }}
+  operator bool() override {{ return sim.connected; }}
+
+private:
+  int _connect()
+  {{
+    sim.connected = true;
+    sim.subscribed = false;
+    sim.head = sim.tail = 0;
+    sim.type = 0;
+    return 1;
+  }}
+}};
+
+struct sim_transport {{
+  typedef SimClient client_t;
+  static void begin(uint8_t) {{}}
+  static bool hardware_ok()     {{ return true; }}
+  static bool link_ok()         {{ return true; }}
+  static IPAddress local_ip()   {{ return IPAddress(192, 168, 10, 10); }}
+  static IPAddress server()     {{ return IPAddress(192, 168, 10, 1); }}
+}};
+
+typedef MQTT_manager<PROPS_NUM, strID, propsNames, riddles_num_in_ERP, onSrt, onRst,
+                     props_cbs, nullptr, nullptr, 0, sim_transport> manager_t;
+manager_t *manager;
+Console *console;
+
+/// the script, see the tool's usage
+static void sim_step()
+{{
+  static const char *const verbs[] = {{ "activate", "finish", "reset" }};
+  static char topic[40];
+  if (!sim.connected || !sim.subscribed || millis() - sim.last < COMMAND_PERIOD)
+    return;
+  sim.last = millis();
+
+  if (sim.commands < COMMANDS) {{
+    size_t i = sim.commands % PROPS_NUM;
+    strcpy(topic, "/er/");
+    strcat(topic, propsNames[i]);
+    strcat(topic, "/cmd");
+    sim_publish(topic, verbs[sim.commands / PROPS_NUM % 3]);
+    if (++sim.commands % DROP_EVERY == 0)
+      sim.connected = false;
+    return;
+  }}
+  switch (sim.finale++) {{
+  case 0: sim_publish("/er/diag", "profile"); break;
+  case 1: sim_publish("/er/diag", "bench"); break;
+  case 4: console->println(F("{done}")); break;
+  }}
+}}
+
+void setup()
+{{
+  console = new Console();
+  manager = new manager_t(console, 10);
+}}
+
+void loop()
+{{
+  manager->routine(props_states);
+  sim_step();
+}}
+"""
+
+
+def sketch(args):
+    props = args.props
+    return SKETCH.format(
+        props=props, period=args.period, commands=args.commands, drop=args.drop,
+        names="\n".join('const char name%d[] = "prop_%d";' % (i, i) for i in range(props)),
+        name_list=", ".join("name%d" % i for i in range(props)),
+        numbers=", ".join(str(i + 1) for i in range(props)),
+        cbs_list=", ".join("&prop_cbs" for _ in range(props)),
+        states="\n".join("prop_state_t state%d = {0};" % i for i in range(props)),
+        state_list=", ".join("state%d" % i for i in range(props)),
+        done=DONE)
+
+
+def build(args, workdir):
+    name = "ds_mqtt_simavr"
+    sketch_dir = os.path.join(workdir, name)
+    build_dir = os.path.join(workdir, name + "_build")
+    os.makedirs(sketch_dir)
+    with open(os.path.join(sketch_dir, name + ".ino"), "w") as ino:
+        ino.write(sketch(args))
+    subprocess.run([args.arduino_cli, "compile", "--fqbn", args.fqbn,
+                    "--library", REPO, "--build-path", build_dir, sketch_dir],
+                   check=True, stdout=subprocess.DEVNULL)
+    return os.path.join(build_dir, name + ".ino.elf")
+
+
+def run(args, elf):
+    """the UART's JSON msgs until the script is done"""
+    msgs = []
+    sim = subprocess.Popen([args.simavr, "-m", args.mcu, "-f", str(args.freq), elf],
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                           errors="replace")
+    deadline = time.monotonic() + args.timeout
+    try:
+        for line in sim.stdout:
+            if DONE in line:
+                return msgs
+            start = line.find("{")
+            if start >= 0:
+                try:
+                    msgs.append(json.loads(line[start:line.rfind("}") + 1]))
+                except ValueError:
+                    pass
+            if time.monotonic() > deadline:
+                break
+    finally:
+        sim.kill()
+        sim.wait()
+    raise SystemExit("simavr stopped or timed out before the script was done")
+
+
+def report(msgs, freq):
+    sections = {m["sec"]: m for m in msgs if m.get("sec") and m.get("unit") == "cyc"}
+    benches = [m for m in msgs if "bench" in m and "cyc" in m]
+    rows = []
+    print("%-12s %8s %10s %10s %9s" % ("section", "n", "avg cyc", "max cyc", "avg us"))
+    for name, label in (("dispatch", "dispatch"), ("info", "heartbeat"), ("connect", "reconnect"),
+                        ("net", "net"), ("health", "health")):
+        sec = sections.get(name)
+        if sec is None:
+            continue
+        rows.append(dict(sec, name=label))
+        print("%-12s %8d %10d %10d %9.1f" % (label, sec["n"], sec["avg"], sec["max"],
+                                             sec["avg"] * 1e6 / freq))
+    for bench in benches:
+        rows.append(bench)
+        print("%-12s %8d %10d %10s %9.1f" % (bench["bench"], bench["n"], bench["cyc"], "",
+                                             bench["cyc"] * 1e6 / freq))
+    if "dispatch_pct" in sections:
+        pct = sections["dispatch_pct"]
+        rows.append(pct)
+        print("dispatch p50 %d p90 %d p99 %d cyc" % (pct["p50"], pct["p90"], pct["p99"]))
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--fqbn", default="arduino:avr:mega")
+    parser.add_argument("--mcu", default="atmega2560")
+    parser.add_argument("--freq", type=int, default=16000000)
+    parser.add_argument("--props", type=int, default=8)
+    parser.add_argument("--commands", type=int, default=200)
+    parser.add_argument("--period", type=int, default=20, help="ms between commands")
+    parser.add_argument("--drop", type=int, default=50, help="commands between connection drops")
+    parser.add_argument("--timeout", type=float, default=600, help="s of host time")
+    parser.add_argument("--json", help="writes the report there too")
+    parser.add_argument("--elf", help="runs this ELF instead of building the sketch")
+    parser.add_argument("--arduino-cli", default="arduino-cli")
+    parser.add_argument("--simavr", default="simavr")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as workdir:
+        msgs = run(args, args.elf or build(args, workdir))
+    rows = report(msgs, args.freq)
+    if not rows:
+        print("no profile msgs on the UART", file=sys.stderr)
+        return 1
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(rows, f, indent=2)
+            f.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Flash/SRAM size regression check of MQTT_manager configurations.
+
+Builds a sketch per configuration of the matrix (1, 8, 32 props; with and
+without special_CB; with and without extra_topics) with arduino-cli,
+reads .text/.data/.bss of the ELFs with avr-size and compares them with
+the baseline. Exits with 1 if a section grows beyond the threshold or
+there is no baseline for the --fqbn (record it with --update).
+
+The libraries the header includes (Ethernet, PubSubClient, ds_console)
+have to be installed for arduino-cli.
+
+usage: ds_mqtt_size.py [--fqbn arduino:avr:mega] [--threshold 32]
+                       [--baseline tools/ds_mqtt_size.json] [--update]
+"""
+import argparse
+import itertools
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SECTIONS = (".text", ".data", ".bss")
+
+SKETCH = """\
+#include <ds_mqtt_manager.h>
+
+constexpr size_t PROPS_NUM = {props};
+constexpr char strID[] = "size_check";
+
+{names}
+const char *propsNames[PROPS_NUM] = {{ {name_list} }};
+constexpr int riddles_num_in_ERP[PROPS_NUM] = {{ {numbers} }};
+
+void onSrt() {{}}
+void onRst() {{}}
+void on_a() {{}}
+void on_f() {{}}
+void on_r() {{}}
+void my_special_cb(char* topic, uint8_t*, unsigned int)
+{{ if (strcmp(topic, "/er/music/cmd") == 0) onSrt(); }}
+const char *extras[] = {{ "/er/music/cmd", "/er/light/cmd" }};
+
+prop_CBs_t prop_cbs = {{ on_a, on_f, on_r }};
+props_CBs_t props_cbs[PROPS_NUM] = {{ {cbs_list} }};
+
+{states}
+props_states_t props_states[PROPS_NUM] = {{ {state_list} }};
+
+MQTT_manager<PROPS_NUM, strID, propsNames, riddles_num_in_ERP,
+             onSrt, onRst, props_cbs{extra_args}> *manager;
+
+void setup()
+{{
+  manager = new MQTT_manager<PROPS_NUM, strID, propsNames, riddles_num_in_ERP,
+                             onSrt, onRst, props_cbs{extra_args}>(new Console(), 10);
+}}
+
+void loop()
+{{
+  manager->routine(props_states);
+}}
+"""
+
+
+def sketch(props, special, extra):
+    extra_args = ""
+    if special or extra:
+        extra_args += ", my_special_cb" if special else ", nullptr"
+    if extra:
+        extra_args += ", extras, 2"
+    return SKETCH.format(
+        props=props,
+        names="\n".join('const char name%d[] = "prop_%d";' % (i, i) for i in range(props)),
+        name_list=", ".join("name%d" % i for i in range(props)),
+        numbers=", ".join(str(i + 1) for i in range(props)),
+        cbs_list=", ".join("&prop_cbs" for _ in range(props)),
+        states="\n".join("prop_state_t state%d = {0};" % i for i in range(props)),
+        state_list=", ".join("state%d" % i for i in range(props)),
+        extra_args=extra_args)
+
+
+def measure(args, name, source, workdir):
+    sketch_dir = os.path.join(workdir, name)
+    build_dir = os.path.join(workdir, name + "_build")
+    os.makedirs(sketch_dir)
+    with open(os.path.join(sketch_dir, name + ".ino"), "w") as ino:
+        ino.write(source)
+    subprocess.run([args.arduino_cli, "compile", "--fqbn", args.fqbn,
+                    "--library", REPO, "--build-path", build_dir, sketch_dir],
+                   check=True, stdout=subprocess.DEVNULL)
+    elf = os.path.join(build_dir, name + ".ino.elf")
+    out = subprocess.run([args.size, "-A", elf], check=True,
+                         capture_output=True, text=True).stdout
+    sizes = dict.fromkeys(SECTIONS, 0)
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0] in sizes:
+            sizes[parts[0]] = int(parts[1])
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--fqbn", default="arduino:avr:mega")
+    parser.add_argument("--baseline", default=os.path.join(REPO, "tools", "ds_mqtt_size.json"))
+    parser.add_argument("--threshold", type=int, default=32,
+                        help="allowed growth of a section, bytes")
+    parser.add_argument("--update", action="store_true", help="rewrite the baseline")
+    parser.add_argument("--arduino-cli", default="arduino-cli")
+    parser.add_argument("--size", default="avr-size")
+    args = parser.parse_args()
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f).get(args.fqbn, {})
+    if not baseline and not args.update:
+        print("no baseline for %s in %s, run with --update to record it"
+              % (args.fqbn, args.baseline), file=sys.stderr)
+        return 1
+
+    results = {}
+    with tempfile.TemporaryDirectory() as workdir:
+        for props, special, extra in itertools.product((1, 8, 32), (False, True), (False, True)):
+            name = "size_p%d%s%s" % (props, "_cb" if special else "", "_extra" if extra else "")
+            results[name] = measure(args, name, sketch(props, special, extra), workdir)
+
+    failed = False
+    print("%-22s %8s %8s %8s" % (("config",) + SECTIONS))
+    for name, sizes in results.items():
+        row = []
+        if name not in baseline and not args.update:
+            print("no baseline for %s, run with --update to record it" % name, file=sys.stderr)
+            failed = True
+        for section in SECTIONS:
+            delta = sizes[section] - baseline.get(name, {}).get(section, sizes[section])
+            failed |= delta > args.threshold
+            row.append("%d%s" % (sizes[section], "%+d" % delta if delta else ""))
+        print("%-22s %8s %8s %8s" % tuple([name] + row))
+
+    if args.update:
+        stored = {}
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                stored = json.load(f)
+        stored[args.fqbn] = results
+        with open(args.baseline, "w") as f:
+            json.dump(stored, f, indent=2, sort_keys=True)
+            f.write("\n")
+    elif failed:
+        print("size grew beyond %d bytes" % args.threshold, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
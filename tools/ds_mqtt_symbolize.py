@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Maps DS_MQTT_SAMPLER histograms to the symbols of the sketch's ELF.
+
+Dumps are read from files or stdin, either the /er/diag/info JSON msgs
+(e.g. `mosquitto_sub -t /er/diag/info`, `-v` prefixes are fine) or the
+console "sample <bucket> <count>" lines (then --lo and --shift are needed).
+A bucket's count is split between the symbols proportionally to how much
+of the bucket each of them covers.
+
+usage: ds_mqtt_symbolize.py sketch.elf [dump ...] [--id CLIENT_NAME]
+"""
+import argparse
+import collections
+import json
+import subprocess
+import sys
+
+
+def read_symbols(elf, nm):
+    out = subprocess.run([nm, "--numeric-sort", "--print-size", "--demangle",
+                          "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4 or parts[2] not in "TtWw":
+            continue
+        start, size = int(parts[0], 16), int(parts[1], 16)
+        if size:
+            symbols.append((start, start + size, parts[3]))
+    return symbols
+
+
+def read_buckets(lines, args):
+    """returns {(lo, shift): {bucket: count}}, dumps are summed up"""
+    hist = collections.defaultdict(collections.Counter)
+    for line in lines:
+        line = line.strip()
+        if line.startswith("sample "):
+            if args.lo is None or args.shift is None:
+                sys.exit("console dumps need --lo and --shift")
+            _, bucket, count = line.split()
+            hist[(args.lo, args.shift)][int(bucket)] += int(count)
+            continue
+        brace = line.find("{")
+        if brace < 0:
+            continue
+        try:
+            msg = json.loads(line[brace:])
+        except ValueError:
+            continue
+        if "b" not in msg or (args.id and msg.get("id") != args.id):
+            continue
+        for bucket, count in msg["b"]:
+            hist[(msg["lo"], msg["shift"])][bucket] += count
+    return hist
+
+
+def attribute(hist, symbols):
+    shares = collections.Counter()
+    for (lo, shift), buckets in hist.items():
+        width = 1 << shift
+        for bucket, count in buckets.items():
+            start = lo + bucket * width
+            end = start + width
+            covered = 0
+            for sym_start, sym_end, name in symbols:
+                if sym_end <= start:
+                    continue
+                if sym_start >= end:
+                    break
+                overlap = min(end, sym_end) - max(start, sym_start)
+                shares[name] += count * overlap / width
+                covered += overlap
+            if covered < width:
+                shares["?"] += count * (width - covered) / width
+    return shares
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf")
+    parser.add_argument("dumps", nargs="*")
+    parser.add_argument("--id", help="take only this controller's msgs")
+    parser.add_argument("--lo", type=int, help="DS_MQTT_SAMPLER_LO of console dumps")
+    parser.add_argument("--shift", type=int, help="bucket shift of console dumps")
+    parser.add_argument("--nm", default="avr-nm")
+    parser.add_argument("--top", type=int, default=30)
+    args = parser.parse_args()
+
+    lines = []
+    for path in args.dumps or ["-"]:
+        with (sys.stdin if path == "-" else open(path)) as dump:
+            lines.extend(dump.readlines())
+
+    shares = attribute(read_buckets(lines, args), read_symbols(args.elf, args.nm))
+    total = sum(shares.values()) or 1
+    for name, share in shares.most_common(args.top):
+        print("%6.2f%% %8.1f  %s" % (100 * share / total, share, name))
+
+
+if __name__ == "__main__":
+    main()